@@ -0,0 +1,51 @@
+#!/bin/bash
+#
+# bench.sh - Benchmark the modes of the proxy on this machine
+#
+# usage: ./bench.sh [seconds]
+#
+# Starts ./origin and then ./proxy in each mode in turn, and drives it
+# with ./loadgen: closed-loop with connections kept open, for small
+# cached objects, for large uncached ones and for a slow server, then
+# open-loop at a fixed rate to compare the latencies.
+
+seconds=${1:-10}
+origin_port=18090
+proxy_port=18800
+origin=http://localhost:$origin_port
+
+modes=(\
+"" \
+"-r" \
+"-r -c" \
+"-e" \
+"-e -r -c" \
+)
+
+function run_proxy {
+    ./proxy $1 $proxy_port &> /dev/null &
+    proxy_pid=$!
+    sleep 0.5
+}
+
+function load {
+    echo "  loadgen $*"
+    ./loadgen -d $seconds -x localhost:$proxy_port "$@" | sed 's/^/    /'
+}
+
+make -s proxy origin loadgen || exit 1
+./origin $origin_port &
+origin_pid=$!
+trap 'kill $origin_pid $proxy_pid &> /dev/null' EXIT
+sleep 0.5
+
+for mode in "${modes[@]}"; do
+    echo "proxy $mode"
+    run_proxy "$mode"
+    load -c 32 -k $origin/1024 $origin/4096 $origin/16384
+    load -c 8 -k $origin/4000000
+    load -c 64 -k "$origin/1024?delay=20"
+    load -c 32 -k -r 5000 $origin/1024 $origin/4096
+    kill $proxy_pid
+    wait $proxy_pid &> /dev/null
+done
@@ -0,0 +1,159 @@
+/*
+ * cache.c - Web object cache of the proxy
+ *
+ * Objects are kept in a hash table keyed by the normalized URI, under
+ * one reader-writer lock. Lookups only take the read lock, so hits run
+ * concurrently: a hit takes a reference to the object and stamps it
+ * with the value of a global use counter, both atomically. Inserting
+ * takes the write lock and evicts objects until the new one fits. All
+ * objects are also on a ring, and each eviction compares the next
+ * CACHE_SAMPLE objects after a hand going round it and removes the one
+ * with the oldest stamp: an approximate LRU which costs the same
+ * whatever the number of objects, without moving anything on a hit.
+ * An evicted object is freed when its last reader releases it.
+ */
+#include "proxy.h"
+
+/* cache_hash - hash of the key, for the bucket */
+static unsigned long cache_hash(char *key) {
+	unsigned long h = 5381;
+
+	while (*key)
+		h = h * 33 + (unsigned char)*key++;
+	return h % CACHE_BUCKETS;
+}
+
+/* cache_init - initialize an empty cache holding at most max_size
+ * bytes, in objects of at most max_object bytes
+ */
+void cache_init(cache_t *cp, size_t max_size, size_t max_object) {
+	memset(cp->buckets, 0, sizeof(cp->buckets));
+	cp->size = 0;
+	cp->max_size = max_size;
+	cp->max_object = max_object;
+	cp->clock = 0;
+	cp->hand = NULL;
+	pthread_rwlock_init(&cp->lock, NULL);
+}
+
+/* cache_key - normalize the parts of a URI into key, which must hold
+ * MAXLINE bytes: the host in lower case, the port always written
+ */
+void cache_key(char *key, char *hostname, int port, char *pathname) {
+	char *p;
+
+	snprintf(key, MAXLINE, "%s:%d/%s", hostname, port, pathname);
+	for (p = key; *p != ':'; p++)
+		*p = tolower(*p);
+}
+
+/* cache_find - the object of key in the cache, or NULL. The caller
+ * holds the lock
+ */
+static cache_obj_t *cache_find(cache_t *cp, char *key) {
+	cache_obj_t *obj;
+
+	for (obj = cp->buckets[cache_hash(key)]; obj != NULL; obj = obj->next)
+		if (!strcmp(obj->key, key))
+			return obj;
+	return NULL;
+}
+
+/* cache_lookup - the object of key with a reference taken, or NULL.
+ * Release it with cache_release
+ */
+cache_obj_t *cache_lookup(cache_t *cp, char *key) {
+	cache_obj_t *obj;
+
+	pthread_rwlock_rdlock(&cp->lock);
+	if ((obj = cache_find(cp, key)) != NULL) {
+		__atomic_add_fetch(&obj->refs, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&obj->stamp,
+				__atomic_add_fetch(&cp->clock, 1, __ATOMIC_RELAXED),
+				__ATOMIC_RELAXED);
+	}
+	pthread_rwlock_unlock(&cp->lock);
+	return obj;
+}
+
+/* cache_release - drop a reference to the object, free it with the last */
+void cache_release(cache_obj_t *obj) {
+	if (__atomic_sub_fetch(&obj->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		Free(obj->key);
+		Free(obj->data);
+		Free(obj);
+	}
+}
+
+/* cache_evict - remove the oldest of the next CACHE_SAMPLE objects of
+ * the ring. The caller holds the write lock
+ */
+static void cache_evict(cache_t *cp) {
+	cache_obj_t **pp, *obj, *victim;
+	int i;
+
+	if ((obj = victim = cp->hand) == NULL)
+		return;
+	for (i = 1; i < CACHE_SAMPLE && (obj = obj->next_all) != cp->hand; i++)
+		if (obj->stamp < victim->stamp)
+			victim = obj;
+
+	/* The hand moves on past the sample */
+	cp->hand = obj->next_all != victim ? obj->next_all : victim->next_all;
+	if (victim->next_all == victim)
+		cp->hand = NULL;
+	else {
+		victim->prev_all->next_all = victim->next_all;
+		victim->next_all->prev_all = victim->prev_all;
+	}
+	for (pp = &cp->buckets[cache_hash(victim->key)]; *pp != victim;
+			pp = &(*pp)->next)
+		;
+	*pp = victim->next;
+	cp->size -= victim->size;
+	cache_release(victim);	/* The reference of the cache */
+}
+
+/* cache_insert - add a copy of the object of key, unless it is too big
+ * or another thread cached it first
+ */
+void cache_insert(cache_t *cp, char *key, char *data, size_t size) {
+	cache_obj_t *obj;
+	unsigned long h;
+
+	if (size > cp->max_object || size > cp->max_size)
+		return;
+
+	obj = Malloc(sizeof(cache_obj_t));
+	obj->key = Malloc(strlen(key) + 1);
+	strcpy(obj->key, key);
+	obj->data = Malloc(size);
+	memcpy(obj->data, data, size);
+	obj->size = size;
+	obj->refs = 1;
+
+	pthread_rwlock_wrlock(&cp->lock);
+	if (cache_find(cp, key) != NULL) {
+		pthread_rwlock_unlock(&cp->lock);
+		cache_release(obj);
+		return;
+	}
+	while (cp->size + size > cp->max_size)
+		cache_evict(cp);
+
+	h = cache_hash(key);
+	obj->stamp = __atomic_add_fetch(&cp->clock, 1, __ATOMIC_RELAXED);
+	obj->next = cp->buckets[h];
+	cp->buckets[h] = obj;
+	if (cp->hand == NULL)
+		cp->hand = obj->prev_all = obj->next_all = obj;
+	else {
+		/* Just behind the hand, the last to be sampled */
+		obj->next_all = cp->hand;
+		obj->prev_all = cp->hand->prev_all;
+		obj->prev_all->next_all = obj;
+		cp->hand->prev_all = obj;
+	}
+	cp->size += size;
+	pthread_rwlock_unlock(&cp->lock);
+}
@@ -758,7 +758,19 @@ int open_clientfd(char *hostname, int port)
 /* $begin open_listenfd */
 int open_listenfd(int port) 
 {
-    int listenfd, optval=1;
+    return open_listenfd_opt(port, 0);
+}
+/* $end open_listenfd */
+
+/*
+ * open_listenfd_opt - open_listenfd with options. LISTEN_REUSEPORT
+ *     lets several sockets listen on the same port, the kernel
+ *     spreading the new connections among them.
+ *     Returns -1 and sets errno on Unix error.
+ */
+int open_listenfd_opt(int port, int flags) 
+{
+    int listenfd, optval=1, err;
     struct sockaddr_in serveraddr;
   
     /* Create a socket descriptor */
@@ -768,7 +780,12 @@ int open_listenfd(int port)
     /* Eliminates "Address already in use" error from bind. */
     if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, 
 		   (const void *)&optval , sizeof(int)) < 0)
-	return -1;
+	goto error;
+
+    if ((flags & LISTEN_REUSEPORT) &&
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, 
+		   (const void *)&optval , sizeof(int)) < 0)
+	goto error;
 
     /* Listenfd will be an endpoint for all requests to port
        on any IP address for this host */
@@ -777,14 +794,19 @@ int open_listenfd(int port)
     serveraddr.sin_addr.s_addr = htonl(INADDR_ANY); 
     serveraddr.sin_port = htons((unsigned short)port); 
     if (bind(listenfd, (SA *)&serveraddr, sizeof(serveraddr)) < 0)
-	return -1;
+	goto error;
 
     /* Make it a listening socket ready to accept connection requests */
     if (listen(listenfd, LISTENQ) < 0)
-	return -1;
+	goto error;
     return listenfd;
+
+ error:
+    err = errno;
+    close(listenfd);
+    errno = err;
+    return -1;
 }
-/* $end open_listenfd */
 
 /******************************************
  * Wrappers for the client/server helper routines 
@@ -810,6 +832,15 @@ int Open_listenfd(int port)
 	unix_error("Open_listenfd error");
     return rc;
 }
+
+int Open_listenfd_opt(int port, int flags) 
+{
+    int rc;
+
+    if ((rc = open_listenfd_opt(port, flags)) < 0)
+	unix_error("Open_listenfd_opt error");
+    return rc;
+}
 /* $end csapp.c */
 
 
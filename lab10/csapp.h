@@ -56,6 +56,9 @@ extern char **environ; /* defined by libc */
 #define MAXBUF   8192  /* max I/O buffer size */
 #define LISTENQ  1024  /* second argument to listen() */
 
+/* Flags of open_listenfd_opt() */
+#define LISTEN_REUSEPORT 1  /* Share the port with other sockets */
+
 /* Our own error-handling functions */
 void unix_error(char *msg);
 void posix_error(int code, char *msg);
@@ -159,10 +162,12 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 /* Client/server helper functions */
 int open_clientfd(char *hostname, int portno);
 int open_listenfd(int portno);
+int open_listenfd_opt(int portno, int flags);
 
 /* Wrappers for client/server helper functions */
 int Open_clientfd(char *hostname, int port);
 int Open_listenfd(int port); 
+int Open_listenfd_opt(int port, int flags);
 
 #endif /* __CSAPP_H__ */
 /* $end csapp.h */
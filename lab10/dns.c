@@ -0,0 +1,141 @@
+/*
+ * dns.c - Host name resolution cache of the proxy
+ *
+ * Names are resolved with getaddrinfo, which is thread-safe, and the
+ * answer is kept for DNS_TTL seconds; a name that does not resolve is
+ * remembered as such for DNS_NEG_TTL seconds. getaddrinfo does not
+ * report the TTL of the records, hence the fixed ones. The cache is
+ * split in DNS_SHARDS shards by hash of the name, each with its own
+ * lock held only to look up or store an entry, never while resolving,
+ * so threads asking for different origins do not contend.
+ */
+#include "proxy.h"
+
+#define DNS_SHARDS		16
+#define DNS_SHARD_MAX	64		/* Entries per shard */
+#define DNS_TTL			60		/* Seconds an address is kept */
+#define DNS_NEG_TTL		10		/* Seconds a failure is kept */
+
+typedef struct dns_entry {
+	char *hostname;
+	struct in_addr addr;
+	int found;							/* 0 if the name did not resolve */
+	time_t expires;
+	struct dns_entry *next;
+} dns_entry_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	dns_entry_t *entries;
+	int count;
+} dns_shard_t;
+
+static dns_shard_t shards[DNS_SHARDS];
+
+/* dns_now - seconds of the monotonic clock */
+static time_t dns_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/* dns_shard - the shard of the hostname */
+static dns_shard_t *dns_shard(char *hostname) {
+	unsigned long h = 5381;
+	char *p;
+
+	for (p = hostname; *p; p++)
+		h = h * 33 + (unsigned char)tolower(*p);
+	return &shards[h % DNS_SHARDS];
+}
+
+/* dns_init - initialize the empty cache */
+void dns_init(void) {
+	int i;
+
+	for (i = 0; i < DNS_SHARDS; i++) {
+		pthread_mutex_init(&shards[i].lock, NULL);
+		shards[i].entries = NULL;
+		shards[i].count = 0;
+	}
+}
+
+/* dns_store - remember the answer for hostname, replacing an old one.
+ * A full shard drops the entry which expires first
+ */
+static void dns_store(dns_shard_t *sp, char *hostname, struct in_addr *addr,
+		int found) {
+	dns_entry_t *e, **pp, **oldest = NULL;
+
+	pthread_mutex_lock(&sp->lock);
+	for (e = sp->entries; e != NULL; e = e->next)
+		if (!strcasecmp(e->hostname, hostname))
+			break;
+
+	if (e == NULL) {
+		if (sp->count >= DNS_SHARD_MAX) {
+			for (pp = &sp->entries; *pp != NULL; pp = &(*pp)->next)
+				if (oldest == NULL || (*pp)->expires < (*oldest)->expires)
+					oldest = pp;
+			e = *oldest;
+			*oldest = e->next;
+			Free(e->hostname);
+			Free(e);
+			sp->count--;
+		}
+		e = Malloc(sizeof(dns_entry_t));
+		e->hostname = Malloc(strlen(hostname) + 1);
+		strcpy(e->hostname, hostname);
+		e->next = sp->entries;
+		sp->entries = e;
+		sp->count++;
+	}
+
+	e->found = found;
+	if (found)
+		e->addr = *addr;
+	e->expires = dns_now() + (found ? DNS_TTL : DNS_NEG_TTL);
+	pthread_mutex_unlock(&sp->lock);
+}
+
+/* dns_resolve - the IPv4 address of hostname, from the cache if it has
+ * a fresh answer. Return -2 if the name does not resolve
+ */
+int dns_resolve(char *hostname, struct in_addr *addr) {
+	dns_shard_t *sp = dns_shard(hostname);
+	dns_entry_t *e;
+	struct addrinfo hints, *res;
+	int found = -1, rc;
+	long start;
+
+	pthread_mutex_lock(&sp->lock);
+	for (e = sp->entries; e != NULL; e = e->next) {
+		if (!strcasecmp(e->hostname, hostname)) {
+			if (e->expires > dns_now()) {
+				found = e->found;
+				*addr = e->addr;
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sp->lock);
+	if (found != -1)
+		return found ? 0 : -2;
+
+	/* Not cached or expired, resolve it without holding the lock */
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	start = metrics_usec();
+	rc = getaddrinfo(hostname, NULL, &hints, &res);
+	metrics_time(METRIC_DNS, metrics_usec() - start);
+	if (rc != 0) {
+		dns_store(sp, hostname, NULL, 0);
+		return -2;
+	}
+	*addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+	freeaddrinfo(res);
+	dns_store(sp, hostname, addr, 1);
+	return 0;
+}
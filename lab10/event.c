@@ -0,0 +1,591 @@
+/*
+ * event.c - Event-driven core of the proxy
+ *
+ * With -e, the proxy runs one epoll loop per CPU instead of the pool
+ * of blocking worker threads. Every loop waits on the shared listening
+ * socket, EPOLLEXCLUSIVE waking only one loop per new connection, or
+ * with -r on a SO_REUSEPORT socket of its own, and on the non-blocking
+ * sockets of its own connections. A connection
+ * goes through the steps of doit as its events arrive:
+ *
+ *   EV_REQUEST  read the request of the client
+ *   EV_CACHED   send the response from the cache, then log it
+ *   EV_CONNECT  wait for the connection to the server
+ *   EV_SEND     send the request to the server
+ *   EV_RELAY    copy the response to the client, then log it
+ *
+ * so the number of threads stays constant however many clients are
+ * connected. The request is parsed by http.c and forwarded with the
+ * headers of the client, and the cache is shared with doit, but the
+ * response is copied as it comes, its end found by the server closing
+ * the connection: each client connection serves a single request, and
+ * each request opens a new connection to the server, without the
+ * keep-alive of both sides nor the pool of upstream.c. Host names are
+ * still resolved synchronously by resolve_host; cached names cost
+ * nothing, but a slow lookup of a new one holds up its loop.
+ */
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include "proxy.h"
+
+#define EV_MAXEVENTS	64
+
+typedef enum {
+	EV_REQUEST, EV_CACHED, EV_CONNECT, EV_SEND, EV_RELAY, EV_CLOSED
+} ev_state_t;
+
+typedef struct ev_conn ev_conn_t;
+
+/* One of the two sockets of a connection, as registered with epoll */
+typedef struct {
+	ev_conn_t *conn;
+	int fd;
+	uint32_t events;					/* Events epoll waits for */
+} ev_end_t;
+
+struct ev_conn {
+	ev_state_t state;
+	ev_end_t client;
+	ev_end_t server;
+	struct sockaddr_in client_sock;
+	rio_t rio;							/* Head of the request, parsed in place */
+	char *uri;							/* For the log */
+	char *key;							/* Of the cache, NULL not to cache */
+	char *object;						/* Response kept for the cache */
+	size_t objsize;
+	size_t objcap;
+	cache_obj_t *obj;					/* Cached response being sent */
+	struct iovec out[3];				/* Its parts still to send */
+	int nout;
+	char buf[MAXBUF];					/* Request, then response bytes */
+	size_t len;							/* Bytes in buf */
+	size_t off;							/* Bytes of buf already sent */
+	size_t total;						/* Bytes relayed to the client */
+	long start;							/* Of the request, for metrics.c */
+	long connect_start;
+	ev_conn_t *next;					/* Next in the closed list */
+};
+
+typedef struct {
+	int epfd;
+	int listenfd;
+	ev_conn_t *closed;					/* Freed after the current events */
+} ev_loop_t;
+
+static int *ev_listenfds;				/* Listening socket of each loop */
+static int ev_pin;						/* Bind the loops to CPUs */
+
+/* ev_watch - set the events epoll waits for on one end of a connection,
+ * adding the socket the first time
+ */
+static void ev_watch(ev_loop_t *lp, ev_end_t *end, uint32_t events, int add) {
+	struct epoll_event ev;
+
+	if (!add && end->events == events)
+		return;
+	ev.events = events;
+	ev.data.ptr = end;
+	if (epoll_ctl(lp->epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, end->fd, &ev) < 0)
+		fprintf(stderr, "epoll_ctl error: %s\n", strerror(errno));
+	end->events = events;
+}
+
+/* ev_close - close both sockets of the connection. Events of this batch
+ * may still point to it, so it is only freed once the batch is done
+ */
+static void ev_close(ev_loop_t *lp, ev_conn_t *c) {
+	if (c->obj != NULL) {
+		cache_release(c->obj);
+		c->obj = NULL;
+	}
+	if (c->client.fd >= 0) {
+		close(c->client.fd);
+		metrics_add(METRIC_CONNS_CLOSED, 1);
+	}
+	if (c->server.fd >= 0)
+		close(c->server.fd);
+	c->state = EV_CLOSED;
+	c->next = lp->closed;
+	lp->closed = c;
+}
+
+/* ev_fail - send an error page to the client and close the connection */
+static void ev_fail(ev_loop_t *lp, ev_conn_t *c) {
+	clienterror(c->client.fd, "GET", "403", "The address cannot find",
+			"Tiny cannot get conneted to the address");
+	ev_close(lp, c);
+}
+
+/* ev_done - log the request served and close the connection */
+static void ev_done(ev_loop_t *lp, ev_conn_t *c) {
+	write_log(c->client_sock, c->uri, c->total);
+	metrics_add(METRIC_BYTES, c->total);
+	metrics_time(METRIC_REQUEST, metrics_usec() - c->start);
+	ev_close(lp, c);
+}
+
+/* ev_send_cached - send the rest of the cached response */
+static void ev_send_cached(ev_loop_t *lp, ev_conn_t *c) {
+	struct iovec *p = c->out + 3 - c->nout;
+	ssize_t n;
+
+	while (c->nout > 0) {
+		if ((n = writev(c->client.fd, p, c->nout)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				ev_watch(lp, &c->client, EPOLLOUT, 0);
+			else
+				ev_close(lp, c);
+			return;
+		}
+		c->total += n;
+		while (c->nout > 0 && n >= p->iov_len) {
+			n -= p->iov_len;
+			p++;
+			c->nout--;
+		}
+		if (c->nout > 0) {
+			p->iov_base = (char *)p->iov_base + n;
+			p->iov_len -= n;
+		}
+	}
+	ev_done(lp, c);
+}
+
+/* ev_cached - start sending the cached response obj, with the
+ * Connection header after its status line as send_cached does
+ */
+static void ev_cached(ev_loop_t *lp, ev_conn_t *c, cache_obj_t *obj) {
+	char *eol = memchr(obj->data, '\n', obj->size);
+	size_t n = eol != NULL ? eol - obj->data + 1 : obj->size;
+
+	c->obj = obj;
+	c->out[0].iov_base = obj->data;
+	c->out[0].iov_len = n;
+	c->out[1].iov_base = "Connection: close\r\n";
+	c->out[1].iov_len = strlen(c->out[1].iov_base);
+	c->out[2].iov_base = obj->data + n;
+	c->out[2].iov_len = obj->size - n;
+	c->nout = 3;
+	c->state = EV_CACHED;
+	metrics_add(METRIC_CACHE_HITS, 1);
+	ev_watch(lp, &c->client, 0, 0);
+	ev_send_cached(lp, c);
+}
+
+/* ev_start - parse the complete request head in the rio_t and serve it
+ * from the cache, or else start connecting to the server, the request
+ * to the server in buf
+ */
+static void ev_start(ev_loop_t *lp, ev_conn_t *c) {
+	char method[MAXLINE], uri[MAXLINE], key[MAXLINE], head[MAXLINE];
+	char hostname[MAXLINE], pathname[MAXLINE];
+	struct iovec iov[HTTP_MAX_HEADERS + 2];
+	struct sockaddr_in serveraddr;
+	http_req_t req;
+	cache_obj_t *obj;
+	int port = 80;	/* default */
+	int i, n, iovcnt, http10, private;
+
+	if (http_read_request(&c->rio, &req) <= 0) {
+		clienterror(c->client.fd, "request", "400", "Bad Request",
+				"Tiny could not parse the request");
+		ev_close(lp, c);
+		return;
+	}
+	c->start = metrics_usec();
+	http_copy(&req, req.method, method, sizeof(method));
+	http_copy(&req, req.uri, uri, sizeof(uri));
+	http10 = req.version.len == 0 || http_is(&req, req.version, "HTTP/1.0");
+
+	/* Determine the method */
+	if (strcasecmp(method, "GET")) {
+		clienterror(c->client.fd, method, "501", "Not Implemented",
+				"Tiny does not implement this method");
+		ev_close(lp, c);
+		return;
+	}
+	if (http_has_body(&req)) {
+		clienterror(c->client.fd, method, "501", "Not Implemented",
+				"Tiny does not forward request bodies");
+		ev_close(lp, c);
+		return;
+	}
+
+	if (parse_uri(uri, hostname, pathname, &port) == -1) {
+		ev_close(lp, c);
+		return;
+	}
+	c->uri = strdup(uri);
+
+	/* Serve it from the cache if possible, under the rules of doit */
+	cache_key(key, hostname, port, pathname);
+	private = http_has_credentials(&req);
+	if (!private && (obj = cache_lookup(&cache, key)) != NULL) {
+		ev_cached(lp, c, obj);
+		return;
+	}
+	metrics_add(METRIC_CACHE_MISSES, 1);
+	if (!private)
+		c->key = strdup(key);
+
+	/* The request line and the headers of the proxy, then the ones of
+	 * the client, gathered into buf. The server closes the connection
+	 * after the response, which ends it */
+	if (port == 80)
+		n = snprintf(head, sizeof(head), "%s /%s %s\r\n"
+				"Host: %s\r\nConnection: close\r\n",
+				method, pathname, http10 ? "HTTP/1.0" : "HTTP/1.1", hostname);
+	else
+		n = snprintf(head, sizeof(head), "%s /%s %s\r\n"
+				"Host: %s:%d\r\nConnection: close\r\n",
+				method, pathname, http10 ? "HTTP/1.0" : "HTTP/1.1", hostname,
+				port);
+	if (n >= sizeof(head)) {
+		ev_close(lp, c);
+		return;
+	}
+	iovcnt = http_head_iov(&req, head, n, iov);
+	c->len = c->off = 0;
+	for (i = 0; i < iovcnt; i++) {
+		if (c->len + iov[i].iov_len > sizeof(c->buf)) {
+			ev_close(lp, c);
+			return;
+		}
+		memcpy(c->buf + c->len, iov[i].iov_base, iov[i].iov_len);
+		c->len += iov[i].iov_len;
+	}
+
+	if (resolve_host(hostname, port, &serveraddr) < 0 ||
+			(c->server.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+		ev_fail(lp, c);
+		return;
+	}
+	c->server.conn = c;
+	c->connect_start = metrics_usec();
+	if (connect(c->server.fd, (SA *)&serveraddr, sizeof(serveraddr)) < 0 &&
+			errno != EINPROGRESS) {
+		ev_fail(lp, c);
+		return;
+	}
+
+	c->state = EV_CONNECT;
+	ev_watch(lp, &c->client, 0, 0);
+	ev_watch(lp, &c->server, EPOLLOUT, 1);
+}
+
+/* ev_read_request - read what the client sent so far into the rio_t,
+ * and start once the head is complete (or fills the buffer), so that
+ * http_read_request finds it all without reading
+ */
+static void ev_read_request(ev_loop_t *lp, ev_conn_t *c) {
+	rio_t *rp = &c->rio;
+	char *p, *end;
+	ssize_t n;
+
+	while ((n = read(c->client.fd, rp->rio_buf + rp->rio_cnt,
+					RIO_BUFSIZE - rp->rio_cnt)) > 0) {
+		rp->rio_cnt += n;
+
+		/* The head ends with the first empty line after the request
+		 * line, empty lines before it are ignored */
+		p = rp->rio_buf;
+		end = p + rp->rio_cnt;
+		while (p < end && (*p == '\r' || *p == '\n'))
+			p++;
+		if (memmem(p, end - p, "\n\r\n", 3) || memmem(p, end - p, "\n\n", 2) ||
+				rp->rio_cnt == RIO_BUFSIZE) {
+			ev_start(lp, c);
+			return;
+		}
+	}
+	if (n == 0 || (errno != EAGAIN && errno != EINTR))
+		ev_close(lp, c);
+}
+
+/* ev_send - send the rest of the request to the server */
+static void ev_send(ev_loop_t *lp, ev_conn_t *c) {
+	ssize_t n;
+
+	while (c->off < c->len) {
+		if ((n = write(c->server.fd, c->buf + c->off, c->len - c->off)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				ev_close(lp, c);
+			return;
+		}
+		c->off += n;
+	}
+	c->len = c->off = 0;
+	c->state = EV_RELAY;
+	ev_watch(lp, &c->server, EPOLLIN, 0);
+}
+
+/* ev_connected - the connection to the server completed or failed */
+static void ev_connected(ev_loop_t *lp, ev_conn_t *c) {
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (getsockopt(c->server.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+		ev_fail(lp, c);
+		return;
+	}
+	metrics_time(METRIC_CONNECT, metrics_usec() - c->connect_start);
+	c->state = EV_SEND;
+	ev_send(lp, c);
+}
+
+/* ev_collect - keep a copy of the n bytes just read into buf, as long
+ * as the response may fit in the cache
+ */
+static void ev_collect(ev_conn_t *c, size_t n) {
+	if (c->objsize + n > MAX_OBJECT_SIZE) {
+		free(c->key);
+		c->key = NULL;
+		return;
+	}
+	if (c->objsize + n > c->objcap) {
+		c->objcap = c->objsize + n > 2 * c->objcap ? c->objsize + n :
+				2 * c->objcap;
+		if (c->objcap > MAX_OBJECT_SIZE)
+			c->objcap = MAX_OBJECT_SIZE;
+		c->object = Realloc(c->object, c->objcap);
+	}
+	memcpy(c->object + c->objsize, c->buf, n);
+	c->objsize += n;
+}
+
+/* ev_cache_fill - cache the whole response collected, under the rules
+ * of relay_response: a 200 of known length which the server neither
+ * sets a cookie with nor forbids caching, without its hop-by-hop
+ * headers, which are squeezed out in place
+ */
+static void ev_cache_fill(ev_conn_t *c) {
+	char line[MAXLINE], value[MAXLINE], *p, *end, *eol, *dst;
+	long long length = -1;
+	int code = 0, hop;
+	size_t n;
+
+	if (c->key == NULL)
+		return;
+	p = c->object;
+	end = p + c->objsize;
+	dst = NULL;
+	while (1) {
+		if ((eol = memchr(p, '\n', end - p)) == NULL ||
+				(n = eol + 1 - p) >= MAXLINE)
+			return;
+		memcpy(line, p, n);
+		line[n] = '\0';
+		p = eol + 1;
+		if (dst == NULL) {
+			/* The status line */
+			sscanf(line, "%*s %d", &code);
+			if (code != 200)
+				return;
+			dst = p;
+			continue;
+		}
+		if (!strcmp(line, "\r\n") || !strcmp(line, "\n"))
+			break;
+		if (header_value(line, "Transfer-Encoding", value) ||
+				header_value(line, "Set-Cookie", value))
+			return;
+		if (header_value(line, "Cache-Control", value) &&
+				(has_token(value, "private") || has_token(value, "no-store")))
+			return;
+		if (header_value(line, "Content-Length", value))
+			length = atoll(value);
+		hop = header_value(line, "Connection", value) ||
+			header_value(line, "Keep-Alive", value) ||
+			header_value(line, "Proxy-Connection", value);
+		if (!hop) {
+			memmove(dst, line, n);
+			dst += n;
+		}
+	}
+	if (length != end - p)
+		return;
+	memmove(dst, line, n);
+	dst += n;
+	memmove(dst, p, end - p);
+	dst += end - p;
+	cache_insert(&cache, c->key, c->object, dst - c->object);
+}
+
+/* ev_relay - copy the response from the server to the client until one
+ * of them would block. Only the blocked side is waited for, so a slow
+ * client stops the reads from the server instead of buffering
+ */
+static void ev_relay(ev_loop_t *lp, ev_conn_t *c) {
+	ssize_t n;
+
+	while (1) {
+		if (c->off == c->len) {
+			n = read(c->server.fd, c->buf, sizeof(c->buf));
+			if (n > 0) {
+				c->len = n;
+				c->off = 0;
+				if (c->key != NULL)
+					ev_collect(c, n);
+			}
+			else if (n == 0) {
+				ev_cache_fill(c);
+				ev_done(lp, c);
+				return;
+			}
+			else if (errno == EAGAIN) {
+				ev_watch(lp, &c->client, 0, 0);
+				ev_watch(lp, &c->server, EPOLLIN, 0);
+				return;
+			}
+			else if (errno != EINTR) {
+				ev_close(lp, c);
+				return;
+			}
+			continue;
+		}
+
+		n = write(c->client.fd, c->buf + c->off, c->len - c->off);
+		if (n > 0) {
+			c->off += n;
+			c->total += n;
+		}
+		else if (errno == EAGAIN) {
+			ev_watch(lp, &c->server, 0, 0);
+			ev_watch(lp, &c->client, EPOLLOUT, 0);
+			return;
+		}
+		else if (errno != EINTR) {
+			ev_close(lp, c);
+			return;
+		}
+	}
+}
+
+/* ev_accept - accept every pending connection and wait for its request */
+static void ev_accept(ev_loop_t *lp) {
+	struct sockaddr_in clientaddr;
+	socklen_t clientlen;
+	ev_conn_t *c;
+	int fd;
+
+	while (1) {
+		clientlen = sizeof(clientaddr);
+		fd = accept4(lp->listenfd, (SA *)&clientaddr, &clientlen, SOCK_NONBLOCK);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+					errno != ECONNABORTED)
+				fprintf(stderr, "accept error: %s\n", strerror(errno));
+			return;
+		}
+
+		c = Calloc(1, sizeof(ev_conn_t));
+		c->state = EV_REQUEST;
+		c->client.conn = c;
+		c->client.fd = fd;
+		c->server.conn = c;
+		c->server.fd = -1;
+		c->client_sock = clientaddr;
+		rio_readinitb(&c->rio, fd);
+		ev_watch(lp, &c->client, EPOLLIN, 1);
+		metrics_add(METRIC_CONNS_OPENED, 1);
+	}
+}
+
+/* ev_handle - advance the connection of end on its events */
+static void ev_handle(ev_loop_t *lp, ev_end_t *end, uint32_t events) {
+	ev_conn_t *c = end->conn;
+
+	if (end == &c->client) {
+		if (c->state == EV_REQUEST)
+			ev_read_request(lp, c);
+		else if (c->state == EV_CACHED && (events & EPOLLOUT))
+			ev_send_cached(lp, c);
+		else if (c->state == EV_RELAY && (events & EPOLLOUT))
+			ev_relay(lp, c);
+		else if (events & (EPOLLERR | EPOLLHUP))
+			ev_close(lp, c);	/* Client gone before the response */
+		return;
+	}
+
+	switch (c->state) {
+	case EV_CONNECT:
+		ev_connected(lp, c);
+		break;
+	case EV_SEND:
+		ev_send(lp, c);
+		break;
+	case EV_RELAY:
+		ev_relay(lp, c);
+		break;
+	default:
+		break;
+	}
+}
+
+/* ev_thread - run the event loop number vargp */
+static void *ev_thread(void *vargp) {
+	ev_loop_t loop;
+	struct epoll_event events[EV_MAXEVENTS], ev;
+	ev_end_t *end;
+	ev_conn_t *c;
+	int i, n, id = (int)(long)vargp;
+
+	if (ev_pin)
+		pin_cpu(id);
+	loop.listenfd = ev_listenfds[id];
+	loop.closed = NULL;
+	if ((loop.epfd = epoll_create1(0)) < 0)
+		unix_error("epoll_create1 error");
+	ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(loop.epfd, EPOLL_CTL_ADD, loop.listenfd, &ev) < 0)
+		unix_error("epoll_ctl error");
+
+	while (1) {
+		if ((n = epoll_wait(loop.epfd, events, EV_MAXEVENTS, -1)) < 0) {
+			if (errno == EINTR)
+				continue;
+			unix_error("epoll_wait error");
+		}
+
+		for (i = 0; i < n; i++) {
+			end = events[i].data.ptr;
+			if (end == NULL)
+				ev_accept(&loop);
+			else if (end->conn->state != EV_CLOSED)
+				ev_handle(&loop, end, events[i].events);
+		}
+
+		while ((c = loop.closed) != NULL) {
+			loop.closed = c->next;
+			free(c->uri);
+			free(c->key);
+			free(c->object);
+			Free(c);
+		}
+	}
+	return NULL;
+}
+
+/* event_main - run nloops event loops, loop i accepting on listenfds[i]
+ * and bound to CPU i if pin is set. The calling thread runs loop 0.
+ * Never returns
+ */
+void event_main(int *listenfds, int nloops, int pin) {
+	pthread_t tid;
+	int i;
+
+	for (i = 0; i < nloops; i++)
+		if (fcntl(listenfds[i], F_SETFL, fcntl(listenfds[i], F_GETFL) | O_NONBLOCK) < 0)
+			unix_error("fcntl error");
+	ev_listenfds = listenfds;
+	ev_pin = pin;
+
+	for (i = 1; i < nloops; i++)
+		Pthread_create(&tid, NULL, ev_thread, (void *)(long)i);
+	ev_thread((void *)0);
+}
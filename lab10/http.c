@@ -0,0 +1,318 @@
+/*
+ * http.c - Streaming parser of the requests of the clients
+ *
+ * http_read_request runs a state machine over the bytes of the request
+ * head as they sit in the buffer of the rio_t of the client, reading
+ * more into that same buffer when the head is not complete, and only
+ * records where the method, URI, version and every header are: nothing
+ * is copied and nothing is allocated. The head must therefore fit in
+ * the RIO_BUFSIZE bytes of the buffer. The slices stay valid until the
+ * next read from the rio_t, long enough to forward the headers with
+ * http_forward, which sends them with a single writev, replacing the
+ * hop-by-hop ones with the headers of the proxy. The event loops of
+ * event.c gather the same pieces with http_head_iov into a buffer.
+ */
+#include "proxy.h"
+
+/* States of the parser */
+enum {
+	S_METHOD, S_URI_START, S_URI, S_VERSION_START, S_VERSION, S_LINE_LF,
+	S_HEADER_START, S_NAME, S_VALUE_START, S_VALUE, S_HEADER_LF, S_END_LF,
+	S_DONE
+};
+
+/* http_set - make s the slice of the head from off to end */
+static void http_set(http_slice_t *s, size_t off, size_t end) {
+	s->off = off;
+	s->len = end - off;
+}
+
+/* http_is - whether the slice is str, ignoring case */
+int http_is(http_req_t *req, http_slice_t s, char *str) {
+	return strlen(str) == s.len && !strncasecmp(req->base + s.off, str, s.len);
+}
+
+/* http_copy - copy the slice into dst as a string, truncated to size */
+char *http_copy(http_req_t *req, http_slice_t s, char *dst, size_t size) {
+	size_t len = s.len < size ? s.len : size - 1;
+
+	memcpy(dst, req->base + s.off, len);
+	dst[len] = '\0';
+	return dst;
+}
+
+/* http_header - the header name of the request, or NULL */
+http_header_t *http_header(http_req_t *req, char *name) {
+	int i;
+
+	for (i = 0; i < req->nheaders; i++)
+		if (http_is(req, req->headers[i].name, name))
+			return &req->headers[i];
+	return NULL;
+}
+
+/* http_has_body - whether the request carries a body, which the proxy
+ * does not forward
+ */
+int http_has_body(http_req_t *req) {
+	http_header_t *h;
+
+	return http_header(req, "Transfer-Encoding") != NULL ||
+		((h = http_header(req, "Content-Length")) != NULL &&
+		!http_is(req, h->value, "0"));
+}
+
+/* http_has_credentials - whether the request carries credentials, the
+ * response may then be personal and must not be cached
+ */
+int http_has_credentials(http_req_t *req) {
+	return http_header(req, "Authorization") != NULL ||
+		http_header(req, "Cookie") != NULL;
+}
+
+/* http_read_request - parse the head of the next request of rp into req.
+ * Return 1 once it is complete, rp then positioned after it, 0 if the
+ * client closed the connection or timed out before a new request, and
+ * -1 if the request is malformed, too large or cut short
+ */
+int http_read_request(rio_t *rp, http_req_t *req) {
+	char *start, c;
+	size_t pos = 0, mark = 0, avail;
+	ssize_t n;
+	int state = S_METHOD;
+	http_header_t *h = NULL;
+
+	if (rp->rio_cnt <= 0) {
+		rp->rio_cnt = 0;
+		rp->rio_bufptr = rp->rio_buf;
+	}
+	start = rp->rio_bufptr;
+	req->nheaders = 0;
+
+	while (state != S_DONE) {
+		avail = rp->rio_cnt;
+		if (pos == avail) {
+			/* Read more, first moving the partial head to the start
+			 * of the buffer to make room */
+			if (start != rp->rio_buf) {
+				memmove(rp->rio_buf, start, avail);
+				start = rp->rio_bufptr = rp->rio_buf;
+			}
+			if (avail == RIO_BUFSIZE)
+				return -1;
+			while ((n = read(rp->rio_fd, start + avail, RIO_BUFSIZE - avail)) < 0 &&
+					errno == EINTR)
+				;
+			if (n <= 0)
+				return (avail == 0 && (n == 0 || errno == EAGAIN)) ? 0 : -1;
+			rp->rio_cnt += n;
+			continue;
+		}
+
+		c = start[pos];
+		switch (state) {
+		case S_METHOD:
+			if ((c == '\r' || c == '\n') && pos == 0) {
+				/* Empty lines before a request are ignored */
+				start++;
+				rp->rio_bufptr++;
+				rp->rio_cnt--;
+				continue;
+			}
+			if (c == ' ') {
+				if (pos == 0)
+					return -1;
+				http_set(&req->method, 0, pos);
+				state = S_URI_START;
+			}
+			else if (c == '\r' || c == '\n')
+				return -1;
+			break;
+		case S_URI_START:
+			if (c == ' ')
+				break;
+			if (c == '\r' || c == '\n')
+				return -1;
+			mark = pos;
+			state = S_URI;
+			break;
+		case S_URI:
+			if (c == ' ' || c == '\r' || c == '\n') {
+				http_set(&req->uri, mark, pos);
+				http_set(&req->version, pos, pos);	/* HTTP/0.9 */
+				state = c == ' ' ? S_VERSION_START :
+						c == '\r' ? S_LINE_LF : S_HEADER_START;
+			}
+			break;
+		case S_VERSION_START:
+			if (c == ' ')
+				break;
+			mark = pos;
+			state = S_VERSION;
+			/* Fall through */
+		case S_VERSION:
+			if (c == '\r' || c == '\n') {
+				http_set(&req->version, mark, pos);
+				state = c == '\r' ? S_LINE_LF : S_HEADER_START;
+			}
+			else if (c == ' ')
+				return -1;
+			break;
+		case S_LINE_LF:
+		case S_HEADER_LF:
+			if (c != '\n')
+				return -1;
+			if (state == S_HEADER_LF)
+				http_set(&h->line, h->line.off, pos + 1);
+			state = S_HEADER_START;
+			break;
+		case S_HEADER_START:
+			if (c == '\r')
+				state = S_END_LF;
+			else if (c == '\n')
+				state = S_DONE;
+			else if (c == ' ' || c == '\t' || c == ':')
+				return -1;	/* Obsolete line folding is not supported */
+			else {
+				if (req->nheaders == HTTP_MAX_HEADERS)
+					return -1;
+				h = &req->headers[req->nheaders++];
+				h->line.off = pos;
+				mark = pos;
+				state = S_NAME;
+			}
+			break;
+		case S_NAME:
+			if (c == ':') {
+				http_set(&h->name, mark, pos);
+				state = S_VALUE_START;
+			}
+			else if (c == '\r' || c == '\n' || c == ' ')
+				return -1;
+			break;
+		case S_VALUE_START:
+			if (c == ' ' || c == '\t')
+				break;
+			mark = pos;
+			http_set(&h->value, pos, pos);
+			state = S_VALUE;
+			/* Fall through */
+		case S_VALUE:
+			if (c == '\r' || c == '\n') {
+				if (c == '\n')
+					http_set(&h->line, h->line.off, pos + 1);
+				state = c == '\r' ? S_HEADER_LF : S_HEADER_START;
+			}
+			else if (c != ' ' && c != '\t')
+				http_set(&h->value, mark, pos + 1);	/* Without trailing blanks */
+			break;
+		case S_END_LF:
+			if (c != '\n')
+				return -1;
+			state = S_DONE;
+			break;
+		}
+		pos++;
+	}
+
+	req->base = start;
+	rp->rio_bufptr = start + pos;
+	rp->rio_cnt -= pos;
+	return 1;
+}
+
+/* http_token - whether the comma-separated list s holds the token of
+ * the slice t, ignoring case
+ */
+static int http_token(http_req_t *req, http_slice_t s, http_slice_t t) {
+	char *p = req->base + s.off, *end = p + s.len, *q;
+
+	while (p < end) {
+		while (p < end && (*p == ',' || *p == ' ' || *p == '\t'))
+			p++;
+		for (q = p; q < end && *q != ',' && *q != ' ' && *q != '\t'; q++)
+			;
+		if (q - p == t.len && !strncasecmp(p, req->base + t.off, t.len))
+			return 1;
+		while (q < end && *q != ',')
+			q++;
+		p = q;
+	}
+	return 0;
+}
+
+/* http_hop_by_hop - whether the header only concerns one connection, so
+ * that the proxy replaces it instead of forwarding it: the standard
+ * ones, and the ones the client names in its Connection header
+ */
+static int http_hop_by_hop(http_req_t *req, http_header_t *h) {
+	int i;
+
+	if (http_is(req, h->name, "Host") ||
+			http_is(req, h->name, "Connection") ||
+			http_is(req, h->name, "Proxy-Connection") ||
+			http_is(req, h->name, "Keep-Alive") ||
+			http_is(req, h->name, "TE") ||
+			http_is(req, h->name, "Trailer") ||
+			http_is(req, h->name, "Upgrade"))
+		return 1;
+	for (i = 0; i < req->nheaders; i++)
+		if ((http_is(req, req->headers[i].name, "Connection") ||
+				http_is(req, req->headers[i].name, "Proxy-Connection")) &&
+				http_token(req, req->headers[i].value, h->name))
+			return 1;
+	return 0;
+}
+
+/* http_head_iov - point iov, of at least HTTP_MAX_HEADERS + 2 entries,
+ * to the head of the request to the server: the request line and Host
+ * header given by the proxy in head, then the headers of the client
+ * which are not hop-by-hop, straight from its buffer, and the empty
+ * line. Return the number of entries
+ */
+int http_head_iov(http_req_t *req, char *head, size_t headlen,
+		struct iovec *iov) {
+	int i, iovcnt;
+
+	iov[0].iov_base = head;
+	iov[0].iov_len = headlen;
+	iovcnt = 1;
+	for (i = 0; i < req->nheaders; i++) {
+		if (http_hop_by_hop(req, &req->headers[i]))
+			continue;
+		iov[iovcnt].iov_base = req->base + req->headers[i].line.off;
+		iov[iovcnt].iov_len = req->headers[i].line.len;
+		iovcnt++;
+	}
+	iov[iovcnt].iov_base = "\r\n";
+	iov[iovcnt].iov_len = 2;
+	return iovcnt + 1;
+}
+
+/* http_forward - send the head of the request of http_head_iov to the
+ * server on fd in one writev. Return -1 on error
+ */
+int http_forward(int fd, http_req_t *req, char *head, size_t headlen) {
+	struct iovec iov[HTTP_MAX_HEADERS + 2], *p = iov;
+	ssize_t n;
+	int iovcnt = http_head_iov(req, head, headlen, iov);
+
+	/* A short write continues from where it stopped */
+	while (iovcnt > 0) {
+		if ((n = writev(fd, p, iovcnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (iovcnt > 0 && n >= p->iov_len) {
+			n -= p->iov_len;
+			p++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			p->iov_base = (char *)p->iov_base + n;
+			p->iov_len -= n;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,355 @@
+/*
+ * loadgen.c - Load generator for benchmarking the proxy
+ *
+ * usage: ./loadgen [-c conns] [-d seconds] [-r rate] [-k] [-x host:port]
+ *                  <url> [url ...]
+ *
+ * Each of the conns threads sends GET requests for the URLs in turn,
+ * through the proxy at host:port if -x is given, for the given number
+ * of seconds, then the requests per second and the latencies are
+ * reported. By default the load is closed-loop: a thread sends its next
+ * request as soon as it has the previous response. With -r, it is
+ * open-loop at rate requests per second in all: every request has a
+ * scheduled time and its latency is counted from then, so a slow
+ * response also delays the requests queued behind it instead of
+ * hiding them. -k keeps the connections open between requests.
+ *
+ * Together with origin.c, e.g.
+ *
+ *   ./origin 18080 &  ./proxy 18800 &
+ *   ./loadgen -c 16 -d 10 -k -x localhost:18800 http://localhost:18080/4096
+ */
+#include "csapp.h"
+
+#define LG_MAX_URLS		64
+#define LG_SCRATCH		65536		/* Bytes of body read at a time */
+
+typedef struct {
+	char request[MAXLINE];			/* The request for the URL */
+	size_t len;
+} lg_url_t;
+
+typedef struct {
+	int id;
+	double *lat;					/* Latencies in microseconds */
+	size_t nlat, cap;
+	long errors;
+	long long bytes;
+} lg_thread_t;
+
+static struct {
+	int conns;
+	double seconds;
+	double rate;					/* 0 for closed-loop */
+	int keepalive;
+	struct sockaddr_in addr;		/* Of the proxy, or of the server */
+	lg_url_t urls[LG_MAX_URLS];
+	int nurls;
+	double start;
+} lg;
+
+/* lg_now - seconds of the monotonic clock */
+static double lg_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* lg_resolve - the address of host:port into addr, -1 if unknown */
+static int lg_resolve(char *host, int port, struct sockaddr_in *addr) {
+	struct addrinfo hints, *res;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, NULL, &hints, &res) != 0)
+		return -1;
+	*addr = *(struct sockaddr_in *)res->ai_addr;
+	addr->sin_port = htons(port);
+	freeaddrinfo(res);
+	return 0;
+}
+
+/* lg_split - split host[:port] into host and port */
+static void lg_split(char *hostport, char *host, int *port) {
+	char *colon;
+
+	strcpy(host, hostport);
+	*port = 80;
+	if ((colon = strchr(host, ':')) != NULL) {
+		*colon = '\0';
+		*port = atoi(colon + 1);
+	}
+}
+
+/* lg_add_url - prepare the request for url. Without a proxy, the first
+ * URL also gives the server. Return -1 if it is not a http:// URL
+ */
+static int lg_add_url(char *url, int proxied) {
+	char hostport[MAXLINE], host[MAXLINE], *path;
+	lg_url_t *u = &lg.urls[lg.nurls];
+	int port, n;
+
+	if (strncasecmp(url, "http://", 7) || strlen(url) >= MAXLINE / 2)
+		return -1;
+	strcpy(hostport, url + 7);
+	if ((path = strchr(hostport, '/')) != NULL)
+		*path = '\0';
+	path = strchr(url + 7, '/');
+
+	n = snprintf(u->request, sizeof(u->request), "GET %s HTTP/1.1\r\n"
+			"Host: %s\r\n%s\r\n", proxied ? url : (path ? path : "/"),
+			hostport, lg.keepalive ? "" : "Connection: close\r\n");
+	u->len = n;
+
+	if (!proxied && lg.nurls == 0) {
+		lg_split(hostport, host, &port);
+		if (lg_resolve(host, port, &lg.addr) < 0)
+			return -1;
+	}
+	lg.nurls++;
+	return 0;
+}
+
+/* lg_connect - a new connection to the proxy or server, or -1 */
+static int lg_connect(void) {
+	int fd;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (connect(fd, (SA *)&lg.addr, sizeof(lg.addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* lg_skip - read and drop n bytes, or up to EOF if n is negative.
+ * Return the bytes read, -1 if EOF came first
+ */
+static long long lg_skip(rio_t *rio, long long n) {
+	static __thread char scratch[LG_SCRATCH];
+	long long total = 0;
+	ssize_t rc;
+
+	while (n != 0) {
+		rc = rio_readnb(rio, scratch, (n < 0 || n > LG_SCRATCH) ? LG_SCRATCH : n);
+		if (rc <= 0)
+			return n < 0 ? total : -1;
+		total += rc;
+		if (n > 0)
+			n -= rc;
+	}
+	return total;
+}
+
+/* lg_response - read the response. Return its bytes, or -1 on error;
+ * *reusable tells whether the connection can take another request
+ */
+static long long lg_response(rio_t *rio, int *reusable) {
+	char line[MAXLINE];
+	long long length = -1, total = 0, n, chunk;
+	int code = 0, chunked = 0;
+	ssize_t rc;
+
+	*reusable = lg.keepalive;
+	if ((rc = rio_readlineb(rio, line, MAXLINE)) <= 0 ||
+			sscanf(line, "HTTP/%*s %d", &code) != 1)
+		return -1;
+	total += rc;
+	while ((rc = rio_readlineb(rio, line, MAXLINE)) > 0 &&
+			strcmp(line, "\r\n") && strcmp(line, "\n")) {
+		total += rc;
+		if (!strncasecmp(line, "Content-Length:", 15))
+			length = atoll(line + 15);
+		else if (!strncasecmp(line, "Transfer-Encoding:", 18) &&
+				strstr(line, "chunked"))
+			chunked = 1;
+		else if (!strncasecmp(line, "Connection:", 11) && strstr(line, "close"))
+			*reusable = 0;
+	}
+	if (rc <= 0)
+		return -1;
+	total += rc;
+
+	if (code / 100 == 1 || code == 204 || code == 304)
+		n = 0;
+	else if (chunked) {
+		while ((rc = rio_readlineb(rio, line, MAXLINE)) > 0 &&
+				(chunk = strtoll(line, NULL, 16)) > 0) {
+			/* The data and its CRLF */
+			if ((n = lg_skip(rio, chunk + 2)) < 0)
+				return -1;
+			total += rc + n;
+		}
+		/* The trailer up to the empty line */
+		while (rc > 0 && (rc = rio_readlineb(rio, line, MAXLINE)) > 0 &&
+				strcmp(line, "\r\n") && strcmp(line, "\n"))
+			;
+		if (rc <= 0)
+			return -1;
+		n = 0;
+	}
+	else if (length >= 0)
+		n = lg_skip(rio, length);
+	else {
+		n = lg_skip(rio, -1);
+		*reusable = 0;
+	}
+	if (n < 0)
+		return -1;
+	return code == 200 ? total + n : -1;
+}
+
+/* lg_record - add a latency to the thread */
+static void lg_record(lg_thread_t *t, double usec) {
+	if (t->nlat == t->cap) {
+		t->cap = t->cap ? 2 * t->cap : 4096;
+		t->lat = Realloc(t->lat, t->cap * sizeof(double));
+	}
+	t->lat[t->nlat++] = usec;
+}
+
+/* lg_thread - send requests until the end of the run */
+static void *lg_thread(void *vargp) {
+	lg_thread_t *t = vargp;
+	double end = lg.start + lg.seconds, now, sent, next = lg.start;
+	double interval = lg.rate > 0 ? lg.conns / lg.rate : 0;
+	long long bytes;
+	int fd = -1, reusable, u = t->id % lg.nurls;
+	rio_t rio;
+
+	/* Spread the schedules of the threads over one interval */
+	next += interval * t->id / lg.conns;
+	while ((now = lg_now()) < end) {
+		if (interval > 0) {
+			if (next >= end)
+				break;
+			if (now < next)
+				usleep((next - now) * 1e6);
+			sent = next;
+			next += interval;
+		}
+		else
+			sent = now;
+
+		if (fd < 0) {
+			if ((fd = lg_connect()) < 0) {
+				t->errors++;
+				continue;
+			}
+			Rio_readinitb(&rio, fd);
+		}
+		if (rio_writen(fd, lg.urls[u].request, lg.urls[u].len) < 0 ||
+				(bytes = lg_response(&rio, &reusable)) < 0) {
+			t->errors++;
+			close(fd);
+			fd = -1;
+			continue;
+		}
+		lg_record(t, (lg_now() - sent) * 1e6);
+		t->bytes += bytes;
+		u = (u + 1) % lg.nurls;
+		if (!reusable) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	if (fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+/* lg_compare - order of two latencies, for qsort */
+static int lg_compare(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+	char host[MAXLINE];
+	lg_thread_t *threads;
+	pthread_t *tids;
+	double *all, elapsed, sum = 0;
+	size_t n = 0, i;
+	long errors = 0;
+	long long bytes = 0;
+	int c, port, proxied = 0;
+
+	lg.conns = 8;
+	lg.seconds = 10;
+	while ((c = getopt(argc, argv, "c:d:r:kx:")) != -1) {
+		switch (c) {
+		case 'c':
+			lg.conns = atoi(optarg);
+			break;
+		case 'd':
+			lg.seconds = atof(optarg);
+			break;
+		case 'r':
+			lg.rate = atof(optarg);
+			break;
+		case 'k':
+			lg.keepalive = 1;
+			break;
+		case 'x':
+			lg_split(optarg, host, &port);
+			if (lg_resolve(host, port, &lg.addr) < 0)
+				app_error("cannot resolve the proxy");
+			proxied = 1;
+			break;
+		default:
+			argc = 0;
+			break;
+		}
+	}
+	if (argc <= optind || argc - optind > LG_MAX_URLS ||
+			lg.conns < 1 || lg.seconds <= 0 || lg.rate < 0) {
+		fprintf(stderr, "Usage: %s [-c conns] [-d seconds] [-r rate] [-k] "
+				"[-x host:port] <url> [url ...]\n", argv[0]);
+		exit(0);
+	}
+	for (; optind < argc; optind++)
+		if (lg_add_url(argv[optind], proxied) < 0)
+			app_error("bad URL");
+	Signal(SIGPIPE, SIG_IGN);
+
+	threads = Calloc(lg.conns, sizeof(lg_thread_t));
+	tids = Calloc(lg.conns, sizeof(pthread_t));
+	lg.start = lg_now();
+	for (c = 0; c < lg.conns; c++) {
+		threads[c].id = c;
+		Pthread_create(&tids[c], NULL, lg_thread, &threads[c]);
+	}
+	for (c = 0; c < lg.conns; c++)
+		Pthread_join(tids[c], NULL);
+	elapsed = lg_now() - lg.start;
+
+	/* Merge the latencies of the threads */
+	for (c = 0; c < lg.conns; c++)
+		n += threads[c].nlat;
+	all = Malloc((n + 1) * sizeof(double));
+	for (n = 0, c = 0; c < lg.conns; c++) {
+		memcpy(all + n, threads[c].lat, threads[c].nlat * sizeof(double));
+		n += threads[c].nlat;
+		errors += threads[c].errors;
+		bytes += threads[c].bytes;
+	}
+	qsort(all, n, sizeof(double), lg_compare);
+	for (i = 0; i < n; i++)
+		sum += all[i];
+
+	printf("%s, %d connections%s: %lu requests in %.2f s, %.1f req/s, "
+			"%.2f MB/s, %ld errors\n",
+			lg.rate > 0 ? "Open loop" : "Closed loop", lg.conns,
+			lg.keepalive ? " kept open" : "", (unsigned long)n, elapsed,
+			n / elapsed, bytes / elapsed / 1e6, errors);
+	if (n > 0)
+		printf("Latency (us): mean %.0f, p50 %.0f, p99 %.0f, p999 %.0f, "
+				"max %.0f\n", sum / n, all[(size_t)(0.5 * (n - 1))],
+				all[(size_t)(0.99 * (n - 1))], all[(size_t)(0.999 * (n - 1))],
+				all[n - 1]);
+	exit(errors > 0 && n == 0);
+}
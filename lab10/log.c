@@ -0,0 +1,253 @@
+/*
+ * log.c - Asynchronous access log of the proxy
+ *
+ * write_log does not touch the log file: it appends a record of the
+ * request to a ring of its own thread and returns. Each ring has one
+ * producer, its thread, and one consumer, the writer thread, so the
+ * two only share the head and tail indexes and no lock is taken. The
+ * writer wakes up every LOG_FLUSH_MS milliseconds, or as soon as a ring
+ * gets half full, formats the records with format_log_entry and writes
+ * a batch of up to LOG_BATCH lines with one writev on the log file it
+ * keeps open. Past LOG_ROTATE_SIZE bytes the file is renamed with a .1
+ * suffix, replacing the previous one, and a new one is started.
+ *
+ * A thread whose ring is full drops its record rather than wait, and
+ * the writer reports the count. Lines of different threads may reach
+ * the file slightly out of order.
+ */
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include "proxy.h"
+
+#define LOG_RING_SIZE	(64 * 1024)	/* Bytes, a power of 2 */
+#define LOG_ALIGN		32			/* Records are multiples of this */
+#define LOG_BATCH		256			/* Lines per writev */
+#define LOG_FLUSH_MS	100
+#define LOG_ROTATE_SIZE	(64 * 1024 * 1024)
+
+/* A record, or the padding up to the end of the ring if pad is set */
+typedef struct {
+	unsigned len;						/* Bytes of the record */
+	unsigned pad;
+	unsigned addr;						/* Client address, network order */
+	int size;
+	time_t time;
+	char uri[];
+} log_rec_t;
+
+typedef struct log_ring {
+	char buf[LOG_RING_SIZE];
+	size_t head;						/* Bytes ever written, by the thread */
+	size_t tail;						/* Bytes ever read, by the writer */
+	int dead;							/* The thread exited */
+	struct log_ring *next;
+} log_ring_t;
+
+static struct {
+	char path[MAXLINE];
+	int fd;
+	off_t size;							/* Bytes in the file */
+	int efd;							/* eventfd waking up the writer */
+	pthread_mutex_t lock;				/* Protects rings */
+	log_ring_t *rings;
+	pthread_key_t key;					/* The ring of the thread */
+	unsigned long dropped;
+} logger;
+
+/* log_open - open the log file for appending */
+static void log_open(void) {
+	struct stat st;
+
+	if ((logger.fd = open(logger.path, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0)
+		unix_error("open log error");
+	logger.size = fstat(logger.fd, &st) == 0 ? st.st_size : 0;
+}
+
+/* log_rotate - move the full log file to path.1 and start a new one */
+static void log_rotate(void) {
+	char old[MAXLINE + 2];
+
+	close(logger.fd);
+	snprintf(old, sizeof(old), "%s.1", logger.path);
+	if (rename(logger.path, old) < 0)
+		fprintf(stderr, "log rotation error: %s\n", strerror(errno));
+	log_open();
+}
+
+/* log_thread_exit - mark the ring of an exiting thread, the writer
+ * frees it once it is drained
+ */
+static void log_thread_exit(void *ring) {
+	__atomic_store_n(&((log_ring_t *)ring)->dead, 1, __ATOMIC_RELEASE);
+}
+
+/* log_ring - the ring of the calling thread, created on its first use */
+static log_ring_t *log_ring(void) {
+	log_ring_t *r;
+
+	if ((r = pthread_getspecific(logger.key)) != NULL)
+		return r;
+	r = Calloc(1, sizeof(log_ring_t));
+	pthread_setspecific(logger.key, r);
+	pthread_mutex_lock(&logger.lock);
+	r->next = logger.rings;
+	logger.rings = r;
+	pthread_mutex_unlock(&logger.lock);
+	return r;
+}
+
+/* log_flush - write the lines of iov to the log file, rotating it when
+ * it grows too big
+ */
+static void log_flush(struct iovec *iov, int n) {
+	ssize_t rc;
+	int i = 0;
+
+	while (i < n) {
+		if ((rc = writev(logger.fd, iov + i, n - i)) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "log write error: %s\n", strerror(errno));
+			return;
+		}
+		logger.size += rc;
+		/* Skip the lines written, a short write ends inside one */
+		while (i < n && rc >= iov[i].iov_len)
+			rc -= iov[i++].iov_len;
+		if (i < n) {
+			iov[i].iov_base = (char *)iov[i].iov_base + rc;
+			iov[i].iov_len -= rc;
+		}
+	}
+	if (logger.size >= LOG_ROTATE_SIZE)
+		log_rotate();
+}
+
+/* log_drain - write every record of the ring to the log file. Return
+ * whether the ring is empty and its thread is gone
+ */
+static int log_drain(log_ring_t *r) {
+	static char lines[LOG_BATCH][MAXLINE];
+	struct iovec iov[LOG_BATCH];
+	struct sockaddr_in sockaddr;
+	size_t head, tail = r->tail;
+	log_rec_t *rec;
+	int dead, n = 0;
+
+	/* dead first: records written before the thread exited are seen */
+	dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+	head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	memset(&sockaddr, 0, sizeof(sockaddr));
+
+	while (tail != head) {
+		rec = (log_rec_t *)(r->buf + tail % LOG_RING_SIZE);
+		if (!rec->pad) {
+			sockaddr.sin_addr.s_addr = rec->addr;
+			format_log_entry(lines[n], rec->time, &sockaddr, rec->uri,
+					rec->size);
+			iov[n].iov_base = lines[n];
+			iov[n].iov_len = strlen(lines[n]);
+			n++;
+		}
+		tail += rec->len;
+		if (n == LOG_BATCH || tail == head) {
+			log_flush(iov, n);
+			n = 0;
+			/* Give the space back to the thread */
+			__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+		}
+	}
+	return dead && tail == head;
+}
+
+/* log_writer - thread draining the rings into the log file */
+static void *log_writer(void *vargp) {
+	struct pollfd pfd = { logger.efd, POLLIN, 0 };
+	log_ring_t **pp, *r;
+	unsigned long reported = 0, dropped;
+	uint64_t count;
+
+	Pthread_detach(pthread_self());
+	while (1) {
+		if (poll(&pfd, 1, LOG_FLUSH_MS) > 0 &&
+				read(logger.efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+			fprintf(stderr, "log eventfd error: %s\n", strerror(errno));
+
+		pthread_mutex_lock(&logger.lock);
+		pp = &logger.rings;
+		while ((r = *pp) != NULL) {
+			if (log_drain(r)) {
+				*pp = r->next;
+				Free(r);
+			}
+			else
+				pp = &r->next;
+		}
+		pthread_mutex_unlock(&logger.lock);
+
+		dropped = __atomic_load_n(&logger.dropped, __ATOMIC_RELAXED);
+		if (dropped != reported) {
+			fprintf(stderr, "log: %lu entries dropped, rings full\n",
+					dropped - reported);
+			reported = dropped;
+		}
+	}
+	return NULL;
+}
+
+/* log_init - open the log file at path and start the writer thread */
+void log_init(char *path) {
+	pthread_t tid;
+
+	snprintf(logger.path, sizeof(logger.path), "%s", path);
+	log_open();
+	if ((logger.efd = eventfd(0, EFD_NONBLOCK)) < 0)
+		unix_error("eventfd error");
+	pthread_mutex_init(&logger.lock, NULL);
+	pthread_key_create(&logger.key, log_thread_exit);
+	logger.rings = NULL;
+	logger.dropped = 0;
+	Pthread_create(&tid, NULL, log_writer, NULL);
+}
+
+/* write_log - log the request of the client for uri, answered with size
+ * bytes. Only copies it to the ring of the thread; dropped if full
+ */
+void write_log(struct sockaddr_in client_sock, char *uri, int size) {
+	log_ring_t *r = log_ring();
+	size_t urilen = strlen(uri) + 1;
+	size_t need = (sizeof(log_rec_t) + urilen + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1);
+	size_t start = r->head, head = start;
+	size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	size_t to_end = LOG_RING_SIZE - head % LOG_RING_SIZE;
+	uint64_t one = 1;
+	log_rec_t *rec;
+
+	/* A record never wraps, the end of the ring is padded instead */
+	if (head + need + (need > to_end ? to_end : 0) - tail > LOG_RING_SIZE) {
+		__atomic_add_fetch(&logger.dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (need > to_end) {
+		rec = (log_rec_t *)(r->buf + head % LOG_RING_SIZE);
+		rec->len = to_end;
+		rec->pad = 1;
+		head += to_end;
+	}
+
+	rec = (log_rec_t *)(r->buf + head % LOG_RING_SIZE);
+	rec->len = need;
+	rec->pad = 0;
+	rec->addr = client_sock.sin_addr.s_addr;
+	rec->size = size;
+	rec->time = time(NULL);
+	memcpy(rec->uri, uri, urilen);
+	__atomic_store_n(&r->head, head + need, __ATOMIC_RELEASE);
+
+	/* Wake the writer early when the ring crosses half full */
+	if (start - tail < LOG_RING_SIZE / 2 &&
+			head + need - tail >= LOG_RING_SIZE / 2 &&
+			write(logger.efd, &one, sizeof(one)) < 0)
+		fprintf(stderr, "log eventfd error: %s\n", strerror(errno));
+}
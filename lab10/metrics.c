@@ -0,0 +1,285 @@
+/*
+ * metrics.c - Runtime counters of the proxy, served to Prometheus
+ *
+ * Every thread counts into a block of its own, found through a
+ * thread-specific key like the rings of log.c, so a count is a plain
+ * load and store on memory no other thread writes: no lock and no
+ * atomic read-modify-write. Times go to histograms with fixed buckets,
+ * from METRIC_MIN_USEC microseconds doubling up to about 17 seconds.
+ * A block of an exiting thread is added to the totals of the retired
+ * threads and freed.
+ *
+ * With -m port, a thread answers any GET on 127.0.0.1:port with the
+ * sums over the blocks, in the Prometheus text exposition format,
+ * plus the gauges read when asked: the connections being served, the
+ * share of the requests served from the cache, the depth of the sbuf
+ * and the number of workers of the pool. The event loops of -e do not
+ * use the cache, and count neither hits nor misses: the share is then
+ * left out instead of reading 0.
+ */
+#include "proxy.h"
+
+#define METRIC_MIN_USEC		64		/* Bound of the first bucket */
+
+typedef struct {
+	unsigned long buckets[METRIC_BUCKETS];	/* Not cumulative */
+	unsigned long count;
+	unsigned long sum;					/* Microseconds */
+} metrics_hist_t;
+
+typedef struct metrics_block {
+	unsigned long counters[METRIC_COUNTERS];
+	metrics_hist_t hists[METRIC_HISTOGRAMS];
+	struct metrics_block *next;
+} metrics_block_t;
+
+static struct {
+	pthread_mutex_t lock;				/* Protects blocks and retired */
+	metrics_block_t *blocks;
+	metrics_block_t retired;			/* Sums of the exited threads */
+	pthread_key_t key;					/* The block of the thread */
+	sbuf_t *sp;							/* NULL without the pool */
+	int listenfd;
+} metrics;
+
+static char *metrics_counter_names[METRIC_COUNTERS][2] = {
+	{ "proxy_connections_opened_total", "Client connections accepted." },
+	{ "proxy_connections_closed_total", "Client connections closed." },
+	{ "proxy_cache_hits_total", "Requests served from the cache." },
+	{ "proxy_cache_misses_total", "Requests sent to the servers." },
+	{ "proxy_bytes_relayed_total", "Bytes sent to the clients." },
+	{ "proxy_upstream_reused_total", "Requests on pooled server connections." },
+};
+
+static char *metrics_hist_names[METRIC_HISTOGRAMS][2] = {
+	{ "proxy_request_seconds", "Time from the request to the end of the response." },
+	{ "proxy_upstream_connect_seconds", "Time to connect to a server." },
+	{ "proxy_dns_seconds", "Time of the host name lookups not cached." },
+};
+
+/* metrics_bump - add n to a count only the calling thread writes */
+static void metrics_bump(unsigned long *p, unsigned long n) {
+	__atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + n,
+			__ATOMIC_RELAXED);
+}
+
+/* metrics_fold - add the counts of b to sum */
+static void metrics_fold(metrics_block_t *sum, metrics_block_t *b) {
+	int i, j;
+
+	for (i = 0; i < METRIC_COUNTERS; i++)
+		sum->counters[i] += __atomic_load_n(&b->counters[i], __ATOMIC_RELAXED);
+	for (i = 0; i < METRIC_HISTOGRAMS; i++) {
+		for (j = 0; j < METRIC_BUCKETS; j++)
+			sum->hists[i].buckets[j] +=
+				__atomic_load_n(&b->hists[i].buckets[j], __ATOMIC_RELAXED);
+		sum->hists[i].count += __atomic_load_n(&b->hists[i].count, __ATOMIC_RELAXED);
+		sum->hists[i].sum += __atomic_load_n(&b->hists[i].sum, __ATOMIC_RELAXED);
+	}
+}
+
+/* metrics_thread_exit - keep the counts of an exiting thread */
+static void metrics_thread_exit(void *block) {
+	metrics_block_t **pp;
+
+	pthread_mutex_lock(&metrics.lock);
+	for (pp = &metrics.blocks; *pp != block; pp = &(*pp)->next)
+		;
+	*pp = (*pp)->next;
+	metrics_fold(&metrics.retired, block);
+	pthread_mutex_unlock(&metrics.lock);
+	Free(block);
+}
+
+/* metrics_block - the block of the calling thread, created on its first
+ * count
+ */
+static metrics_block_t *metrics_block(void) {
+	metrics_block_t *b;
+
+	if ((b = pthread_getspecific(metrics.key)) != NULL)
+		return b;
+	b = Calloc(1, sizeof(metrics_block_t));
+	pthread_setspecific(metrics.key, b);
+	pthread_mutex_lock(&metrics.lock);
+	b->next = metrics.blocks;
+	metrics.blocks = b;
+	pthread_mutex_unlock(&metrics.lock);
+	return b;
+}
+
+/* metrics_add - add n to the counter */
+void metrics_add(int counter, unsigned long n) {
+	metrics_bump(&metrics_block()->counters[counter], n);
+}
+
+/* metrics_time - count a time of usec microseconds in the histogram */
+void metrics_time(int hist, long usec) {
+	metrics_hist_t *h = &metrics_block()->hists[hist];
+	long bound = METRIC_MIN_USEC;
+	int i = 0;
+
+	if (usec < 0)
+		usec = 0;
+	while (i < METRIC_BUCKETS - 1 && usec > bound) {
+		bound <<= 1;
+		i++;
+	}
+	metrics_bump(&h->count, 1);
+	metrics_bump(&h->sum, usec);
+	metrics_bump(&h->buckets[i], 1);
+}
+
+/* metrics_usec - microseconds of the monotonic clock, for metrics_time */
+long metrics_usec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/* metrics_write - write every metric to fp */
+static void metrics_write(FILE *fp) {
+	metrics_block_t sum, *b;
+	unsigned long cumulative, count, hits, misses;
+	long bound;
+	int i, j;
+
+	pthread_mutex_lock(&metrics.lock);
+	sum = metrics.retired;
+	for (b = metrics.blocks; b != NULL; b = b->next)
+		metrics_fold(&sum, b);
+	pthread_mutex_unlock(&metrics.lock);
+
+	for (i = 0; i < METRIC_COUNTERS; i++)
+		fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n",
+				metrics_counter_names[i][0], metrics_counter_names[i][1],
+				metrics_counter_names[i][0], metrics_counter_names[i][0],
+				sum.counters[i]);
+
+	fprintf(fp, "# HELP proxy_connections_active Client connections being served.\n"
+			"# TYPE proxy_connections_active gauge\nproxy_connections_active %ld\n",
+			(long)(sum.counters[METRIC_CONNS_OPENED] -
+				sum.counters[METRIC_CONNS_CLOSED]));
+	hits = sum.counters[METRIC_CACHE_HITS];
+	misses = sum.counters[METRIC_CACHE_MISSES];
+	if (hits + misses > 0)
+		fprintf(fp, "# HELP proxy_cache_hit_ratio Share of the requests served "
+				"from the cache.\n# TYPE proxy_cache_hit_ratio gauge\n"
+				"proxy_cache_hit_ratio %g\n", (double)hits / (hits + misses));
+	if (metrics.sp != NULL)
+		fprintf(fp, "# HELP proxy_sbuf_depth Connections waiting for a worker.\n"
+				"# TYPE proxy_sbuf_depth gauge\nproxy_sbuf_depth %d\n"
+				"# HELP proxy_workers Worker threads in the pool.\n"
+				"# TYPE proxy_workers gauge\nproxy_workers %d\n",
+				sbuf_depth(metrics.sp), pool_workers());
+
+	for (i = 0; i < METRIC_HISTOGRAMS; i++) {
+		fprintf(fp, "# HELP %s %s\n# TYPE %s histogram\n",
+				metrics_hist_names[i][0], metrics_hist_names[i][1],
+				metrics_hist_names[i][0]);
+		cumulative = 0;
+		bound = METRIC_MIN_USEC;
+		for (j = 0; j < METRIC_BUCKETS - 1; j++, bound <<= 1) {
+			cumulative += sum.hists[i].buckets[j];
+			fprintf(fp, "%s_bucket{le=\"%g\"} %lu\n", metrics_hist_names[i][0],
+					bound / 1e6, cumulative);
+		}
+		/* metrics_time bumps the count before the bucket, but the loads
+		 * of metrics_fold may still see a bucket ahead of the count: +Inf
+		 * and the count take the larger, so that no bucket exceeds them */
+		cumulative += sum.hists[i].buckets[METRIC_BUCKETS - 1];
+		count = sum.hists[i].count > cumulative ? sum.hists[i].count : cumulative;
+		fprintf(fp, "%s_bucket{le=\"+Inf\"} %lu\n%s_sum %g\n%s_count %lu\n",
+				metrics_hist_names[i][0], count,
+				metrics_hist_names[i][0], sum.hists[i].sum / 1e6,
+				metrics_hist_names[i][0], count);
+	}
+}
+
+/* metrics_serve - answer the request on fd with the metrics */
+static void metrics_serve(int fd) {
+	struct timeval timeout = { 1, 0 };
+	char buf[MAXLINE], head[MAXLINE], *body = NULL;
+	size_t len = 0;
+	rio_t rio;
+	FILE *fp;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	Rio_readinitb(&rio, fd);
+	if (rio_readlineb(&rio, buf, MAXLINE) <= 0)
+		return;
+	if (strncmp(buf, "GET ", 4)) {
+		clienterror(fd, "request", "501", "Not Implemented",
+				"The metrics are only served to GET");
+		return;
+	}
+	while (rio_readlineb(&rio, head, MAXLINE) > 0 &&
+			strcmp(head, "\r\n") && strcmp(head, "\n"))
+		;
+
+	if ((fp = open_memstream(&body, &len)) == NULL)
+		return;
+	metrics_write(fp);
+	fclose(fp);
+	snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %lu\r\nConnection: close\r\n\r\n",
+			(unsigned long)len);
+	if (rio_writen(fd, head, strlen(head)) >= 0)
+		rio_writen(fd, body, len);
+	free(body);
+}
+
+/* metrics_thread - serve the metrics one connection at a time */
+static void *metrics_thread(void *vargp) {
+	int fd;
+
+	Pthread_detach(pthread_self());
+	while (1) {
+		if ((fd = accept(metrics.listenfd, NULL, NULL)) < 0) {
+			if (errno != EINTR && errno != ECONNABORTED)
+				fprintf(stderr, "metrics accept error: %s\n", strerror(errno));
+			continue;
+		}
+		metrics_serve(fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+/* metrics_listen - listening socket on port of the loopback interface */
+static int metrics_listen(int port) {
+	struct sockaddr_in addr;
+	int fd, optval = 1;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (bind(fd, (SA *)&addr, sizeof(addr)) < 0 || listen(fd, LISTENQ) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* metrics_init - start counting, and serving the metrics on port unless
+ * it is 0. sp is the sbuf of the pool, NULL if there is none
+ */
+void metrics_init(int port, sbuf_t *sp) {
+	pthread_t tid;
+
+	pthread_mutex_init(&metrics.lock, NULL);
+	pthread_key_create(&metrics.key, metrics_thread_exit);
+	metrics.blocks = NULL;
+	metrics.sp = sp;
+	if (port == 0)
+		return;
+	if ((metrics.listenfd = metrics_listen(port)) < 0)
+		unix_error("metrics listen error");
+	Pthread_create(&tid, NULL, metrics_thread, NULL);
+}
@@ -0,0 +1,112 @@
+/*
+ * origin.c - Stand-in origin server for benchmarking the proxy
+ *
+ * usage: ./origin <port>
+ *
+ * Serves GET /<bytes>[?delay=<ms>] with a body of that many bytes,
+ * after waiting delay milliseconds, so a benchmark can choose the
+ * object sizes and the latency of the server without the network.
+ * Responses are HTTP/1.1 with a Content-Length and connections are
+ * kept open, one thread per connection. Requests are parsed with the
+ * parser of the proxy in http.c.
+ */
+#include <netinet/tcp.h>
+#include "proxy.h"
+
+#define ORIGIN_CHUNK	65536			/* Bytes of the body per write */
+
+static char pattern[ORIGIN_CHUNK];
+
+/* origin_error - send an error response */
+static void origin_error(int fd, char *status) {
+	char buf[MAXLINE];
+
+	snprintf(buf, sizeof(buf), "HTTP/1.1 %s\r\nContent-Length: 0\r\n\r\n", status);
+	rio_writen(fd, buf, strlen(buf));
+}
+
+/* origin_serve - answer one request. Return whether the connection
+ * stays open
+ */
+static int origin_serve(int fd, rio_t *rio) {
+	char uri[MAXLINE], value[MAXLINE], head[MAXLINE], *query;
+	http_req_t req;
+	http_header_t *h;
+	long long size, n;
+	int delay = 0, keepalive;
+
+	if (http_read_request(rio, &req) <= 0)
+		return 0;
+	keepalive = req.version.len > 0 && !http_is(&req, req.version, "HTTP/1.0");
+	if ((h = http_header(&req, "Connection")) != NULL) {
+		http_copy(&req, h->value, value, sizeof(value));
+		keepalive = strcasecmp(value, "close") != 0;
+	}
+	if (!http_is(&req, req.method, "GET")) {
+		origin_error(fd, "501 Not Implemented");
+		return 0;
+	}
+
+	/* The size and the delay from the path, also of absolute URIs */
+	http_copy(&req, req.uri, uri, sizeof(uri));
+	if (!strncasecmp(uri, "http://", 7) && strchr(uri + 7, '/') != NULL)
+		memmove(uri, strchr(uri + 7, '/'), strlen(strchr(uri + 7, '/')) + 1);
+	if ((query = strstr(uri, "delay=")) != NULL)
+		delay = atoi(query + 6);
+	if (uri[0] != '/' || (size = atoll(uri + 1)) < 0) {
+		origin_error(fd, "404 Not Found");
+		return 0;
+	}
+
+	if (delay > 0)
+		usleep(delay * 1000);
+	snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\n"
+			"Content-Type: application/octet-stream\r\n%s\r\n",
+			size, keepalive ? "" : "Connection: close\r\n");
+	if (rio_writen(fd, head, strlen(head)) < 0)
+		return 0;
+	for (; size > 0; size -= n) {
+		n = size < ORIGIN_CHUNK ? size : ORIGIN_CHUNK;
+		if (rio_writen(fd, pattern, n) < 0)
+			return 0;
+	}
+	return keepalive;
+}
+
+/* origin_thread - serve the connection vargp until it is closed */
+static void *origin_thread(void *vargp) {
+	int fd = (int)(long)vargp;
+	rio_t rio;
+
+	Pthread_detach(pthread_self());
+	Rio_readinitb(&rio, fd);
+	while (origin_serve(fd, &rio))
+		;
+	Close(fd);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	struct sockaddr_in clientaddr;
+	socklen_t clientlen;
+	pthread_t tid;
+	int listenfd, connfd, i, one = 1;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <port number>\n", argv[0]);
+		exit(0);
+	}
+	Signal(SIGPIPE, SIG_IGN);
+	for (i = 0; i < ORIGIN_CHUNK; i++)
+		pattern[i] = 'a' + i % 26;
+
+	listenfd = Open_listenfd(atoi(argv[1]));
+	while (1) {
+		clientlen = sizeof(clientaddr);
+		if ((connfd = accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0)
+			continue;
+		/* The head and the body are separate writes */
+		setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		Pthread_create(&tid, NULL, origin_thread, (void *)(long)connfd);
+	}
+}
@@ -0,0 +1,121 @@
+/*
+ * pool.c - Worker threads growing and shrinking with the load
+ *
+ * The workers take the accepted connections from the sbuf with
+ * pool_get, and a manager thread looks at the depth of the sbuf every
+ * POOL_PERIOD_MS milliseconds. Connections waiting there mean every
+ * worker is busy, typically blocked on a slow server or on a client
+ * kept open: when the depth stays at the high watermark or above for
+ * POOL_GROW_TICKS looks in a row, the manager starts a worker for each
+ * waiting connection. When workers were left idle in every look for
+ * POOL_SHRINK_TICKS in a row and the depth stayed at the low watermark,
+ * it retires half of the fewest idle seen by inserting connections
+ * with fd -1 in the sbuf: the worker which removes one exits. The pool
+ * stays between the min and max workers given to pool_init.
+ */
+#include "proxy.h"
+
+#define POOL_PERIOD_MS		100
+#define POOL_HIGH_WATER		2		/* Connections waiting */
+#define POOL_LOW_WATER		0
+#define POOL_GROW_TICKS		2
+#define POOL_SHRINK_TICKS	50
+
+static struct {
+	sbuf_t *sp;
+	void *(*routine)(void *);			/* Of the workers */
+	int min, max;
+	int high;							/* High watermark for this sbuf */
+	int workers;						/* Running, less the retired */
+	int idle;							/* Workers waiting in pool_get */
+	long next_id;						/* Argument of the next worker */
+} pool;
+
+/* pool_grow - start n more workers */
+static void pool_grow(int n) {
+	pthread_t tid;
+
+	while (n-- > 0) {
+		Pthread_create(&tid, NULL, pool.routine, (void *)pool.next_id++);
+		__atomic_add_fetch(&pool.workers, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/* pool_retire - have n idle workers exit */
+static void pool_retire(int n) {
+	struct sockaddr_in none;
+
+	memset(&none, 0, sizeof(none));
+	while (n-- > 0) {
+		sbuf_insert(pool.sp, -1, &none);
+		__atomic_sub_fetch(&pool.workers, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/* pool_manager - thread resizing the pool to the depth of the sbuf */
+static void *pool_manager(void *vargp) {
+	int depth, idle, workers, busy_ticks = 0, idle_ticks = 0, spare = 0;
+
+	Pthread_detach(pthread_self());
+	while (1) {
+		usleep(POOL_PERIOD_MS * 1000);
+		depth = sbuf_depth(pool.sp);
+		idle = __atomic_load_n(&pool.idle, __ATOMIC_RELAXED);
+		workers = pool.workers;
+
+		busy_ticks = depth >= pool.high ? busy_ticks + 1 : 0;
+		if (busy_ticks >= POOL_GROW_TICKS && workers < pool.max) {
+			pool_grow(depth < pool.max - workers ? depth : pool.max - workers);
+			busy_ticks = 0;
+		}
+
+		/* spare is the fewest idle workers over the idle ticks */
+		if (depth <= POOL_LOW_WATER && idle > 0) {
+			spare = idle_ticks == 0 || idle < spare ? idle : spare;
+			idle_ticks++;
+		}
+		else
+			idle_ticks = 0;
+		if (idle_ticks >= POOL_SHRINK_TICKS) {
+			spare = (spare + 1) / 2;
+			pool_retire(spare < workers - pool.min ? spare : workers - pool.min);
+			idle_ticks = 0;
+		}
+	}
+	return NULL;
+}
+
+/* pool_init - start min workers running routine on sp, given 0, 1, ...
+ * as argument, and the manager keeping between min and max of them
+ */
+void pool_init(sbuf_t *sp, int min, int max, void *(*routine)(void *)) {
+	pthread_t tid;
+
+	pool.sp = sp;
+	pool.routine = routine;
+	pool.min = min;
+	pool.max = max;
+	/* At half the slots at most, so that a small sbuf can reach it */
+	pool.high = (sp->mask + 1) / 2 < POOL_HIGH_WATER ?
+		(sp->mask + 1) / 2 : POOL_HIGH_WATER;
+	pool.workers = pool.idle = 0;
+	pool.next_id = 0;
+	pool_grow(min);
+	if (max > min)
+		Pthread_create(&tid, NULL, pool_manager, NULL);
+}
+
+/* pool_get - the next connection for the calling worker into conn.
+ * Return 0 if the worker is retired instead and must exit
+ */
+int pool_get(conn_t *conn) {
+	__atomic_add_fetch(&pool.idle, 1, __ATOMIC_RELAXED);
+	*conn = sbuf_remove(pool.sp);
+	__atomic_sub_fetch(&pool.idle, 1, __ATOMIC_RELAXED);
+	return conn->fd >= 0;
+}
+
+/* pool_workers - the number of workers in the pool */
+int pool_workers(void) {
+	return __atomic_load_n(&pool.workers, __ATOMIC_RELAXED);
+}
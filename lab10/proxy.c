@@ -11,91 +11,164 @@
  * For this naive proxy, I use the structure of the Producer-Consumer 
  * model to manange the concurrancy request. When the proxy accept a 
  * request from the client, insert it into the buffer, when the thread 
- * free, it take the request out from the buffer, and manange it.
+ * free, it take the request out from the buffer, and manange it. The
+ * buffer is the lock-free ring of sbuf.c, of depth set with -q. The
+ * threads are the pool of pool.c, which grows when connections wait in
+ * the buffer and shrinks when threads stay idle, between the bounds
+ * set with -w min:max.
+ *
+ * Responses of up to MAX_OBJECT_SIZE bytes are kept in the object cache
+ * of cache.c, and later requests for the same URI are served from it.
+ *
+ * Requests go to the servers as HTTP/1.1, and the framing of the
+ * responses is followed so that both the client connection and the
+ * one to the server can be kept open; the latter return to the pool of
+ * idle connections of upstream.c for the next request to that server.
+ * Bodies that are not cached are moved from the server to the client
+ * with splice, without being copied through the proxy.
+ *
+ * With -e, the proxy runs the event-driven core of event.c instead:
+ * one epoll loop per CPU serves every connection without blocking.
+ * It shares the parser and the cache, but serves a single request per
+ * client connection and does not pool the connections to the servers.
+ *
+ * With -r, the proxy listens on one socket per CPU, bound with
+ * SO_REUSEPORT, and the kernel spreads the new connections among them:
+ * each event loop accepts on one of its own, or without -e an acceptor
+ * thread per socket feeds the buffer of the pool, instead of a single
+ * acceptor. -c binds each loop, acceptor and worker to a CPU.
+ *
+ * With -m port, the counters of metrics.c are served on that port of
+ * the loopback interface for Prometheus.
  */ 
 
-#include "csapp.h"
+#define _GNU_SOURCE	/* splice() */
+#include <netinet/tcp.h>
+#include "proxy.h"
 
 #define NTHREADS	4 
-#define SBUFSIZE	16
+#define MAX_THREADS	64	/* Default bound of the pool of threads */
+#define SBUFSIZE	256	/* Default depth of the connection queue */
+#define KEEPALIVE_TIMEOUT	5	/* Seconds an idle client connection is kept */
 
-typedef struct {
-	/* Some information of client */
-	int fd;
-	struct sockaddr_in client_sock;
-} conn_t;
+/* How the end of a response body is found */
+#define BODY_NONE		0	/* No body */
+#define BODY_LENGTH		1	/* Content-Length bytes */
+#define BODY_CHUNKED	2	/* Chunked transfer coding */
+#define BODY_EOF		3	/* The server closes the connection */
 
-typedef struct {
-	int *buf;							/* Buffer array */
-	struct sockaddr_in *client_sock;	/* Buffer of struct of sockaddr_in */
-	int n;								/* Maximum number of slots */
-	int front;							/* buf[(front+1)%n] is first item */
-	int rear;							/* buf[rear%n] is last item */
-	sem_t mutex;						/* Protects accesses to buf */
-	sem_t slots;						/* Counts available slots */
-	sem_t items;						/* Counts available items */
-} sbuf_t;
+#define SPLICE_PIPE_SIZE	(256 * 1024)	/* Bytes moved per splice */
 
-sem_t mutex_log;
+sbuf_t sbuf;
 
-sem_t mutex_get_host;
+int *listenfds;							/* Listening socket of each acceptor */
+int reuseport = 0;						/* One listening socket per CPU */
+int pin = 0;							/* Threads bound to a CPU each */
 
-sbuf_t sbuf;
+cache_t cache;
 
-FILE *logfile;
+pthread_key_t relay_key;				/* Pipe of the thread for splice */
+pthread_once_t relay_once = PTHREAD_ONCE_INIT;
 
 /*
  * Function prototypes
  */
-int parse_uri(char *uri, char *target_addr, char *path, int  *port);
-void format_log_entry(char *logstring, struct sockaddr_in *sockaddr, char *uri, int size);
-void doit(conn_t conn);
-void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
-int open_clientfd_ts(char *hostname, int port);
-void write_log(struct sockaddr_in client_sock, char *uri, int size);
-
-void sbuf_init(sbuf_t *sp, int n);
-void sbuf_deinit(sbuf_t *sp);
-void sbuf_insert(sbuf_t *sp, int item, struct sockaddr_in * client_sock);
-conn_t sbuf_remove(sbuf_t *sp);
+int doit(conn_t conn, rio_t *rio_c);
+void serve(conn_t conn);
 
 void *thread(void *vargp);
-
-
-ssize_t Rio_readlineb_w(rio_t *rp, void *usrbuf, size_t maxlen);
-ssize_t Rio_readn_w(rio_t *rp, void *usrbuf, size_t nbytes);
-void Rio_writen_w(int fd, void *usrbuf, size_t n);
+void *acceptor(void *vargp);
 
 /* 
  * main - Main routine for the proxy program 
  */
 int main(int argc, char **argv)
 {	
-	int listenfd, connfd, port, clientlen, i;
+	int connfd, port, clientlen, i, c;
+	int events = 0, depth = SBUFSIZE, nlisten;
+	int min = NTHREADS, max = MAX_THREADS, mport = 0;
 	struct sockaddr_in clientaddr;
 	pthread_t tid;
 
     /* Check arguments */
-    if (argc != 2) {
-		fprintf(stderr, "Usage: %s <port number>\n", argv[0]);
+	while ((c = getopt(argc, argv, "ercq:w:m:")) != -1) {
+		switch (c) {
+		case 'e':
+			events = 1;
+			break;
+		case 'r':
+			reuseport = 1;
+			break;
+		case 'c':
+			pin = 1;
+			break;
+		case 'q':
+			if ((depth = atoi(optarg)) < 1)
+				argc = 0;
+			break;
+		case 'w':
+			if (sscanf(optarg, "%d:%d", &min, &max) < 1)
+				argc = 0;
+			if (!strchr(optarg, ':'))
+				max = min;
+			if (min < 1 || max < min)
+				argc = 0;
+			break;
+		case 'm':
+			if ((mport = atoi(optarg)) <= 0)
+				argc = 0;
+			break;
+		default:
+			argc = 0;
+			break;
+		}
+	}
+    if (argc != optind + 1) {
+		fprintf(stderr, "Usage: %s [-e] [-r] [-c] [-q depth] [-w min[:max]] [-m port] <port number>\n"
+				"  -e: event loops, one request per client connection and no pooled server connections\n",
+				argv[0]);
 		exit(0);
     }
 	
-	port = atoi(argv[1]);
+	port = atoi(argv[optind]);
 	Signal(SIGPIPE, SIG_IGN);
 
 
-	sbuf_init(&sbuf, SBUFSIZE);
-	Sem_init(&mutex_get_host, 0, 1);
-	Sem_init(&mutex_log, 0, 1);
-
-	listenfd = Open_listenfd(port);
-
-	for (i = 0; i < NTHREADS; i++)
-		Pthread_create(&tid, NULL, thread, NULL);
+	sbuf_init(&sbuf, depth);
+	dns_init();
+	upstream_init();
+	log_init("proxy.log");
+	metrics_init(mport, events ? NULL : &sbuf);
+	cache_init(&cache, MAX_CACHE_SIZE, MAX_OBJECT_SIZE);
+
+	/* One listening socket shared by the event loops or used by the
+	 * acceptor, or with -r one per CPU, among which the kernel spreads
+	 * the connections */
+	nlisten = events || reuseport ? (int)sysconf(_SC_NPROCESSORS_ONLN) : 1;
+	listenfds = Calloc(nlisten, sizeof(int));
+	for (i = 0; i < nlisten; i++) {
+		if (reuseport)
+			listenfds[i] = Open_listenfd_opt(port, LISTEN_REUSEPORT);
+		else
+			listenfds[i] = i == 0 ? Open_listenfd(port) : listenfds[0];
+	}
 
+	/* Event-driven mode, one loop per CPU, does not return */
+	if (events)
+		event_main(listenfds, nlisten, pin);
+
+	/* The workers of the pool serve the connections of the buffer, fed
+	 * by an acceptor per socket with -r, or else by this thread */
+	pool_init(&sbuf, min, max, thread);
+	if (reuseport) {
+		for (i = 0; i < nlisten; i++)
+			Pthread_create(&tid, NULL, acceptor, (void *)(long)i);
+		while (1)
+			pause();
+	}
 	while(1) {
-		connfd = Accept(listenfd, (SA *)&clientaddr, (socklen_t *)&clientlen);
+		clientlen = sizeof(clientaddr);
+		connfd = Accept(listenfds[0], (SA *)&clientaddr, (socklen_t *)&clientlen);
 		sbuf_insert(&sbuf, connfd, &clientaddr);
 	}
 
@@ -103,58 +176,73 @@ int main(int argc, char **argv)
 	exit(0);
 }
 
-/* Thread routine */
+/* Thread routine of the worker vargp, takes the connections from the
+ * buffer until the pool retires it */
 void *thread(void *vargp) {
 	Pthread_detach(pthread_self());	/* Detach to avoid memory leak */
+	int id = (int)(long)vargp;
 	conn_t conn;
-	while(1) {
-		conn = sbuf_remove(&sbuf);	/* Remove connfd from buffer */
-		doit(conn);					/* Service client */
-		Close(conn.fd);
-	}
-}
 
-/* Create an empty, bounded, shared FIFO buffer with n slots */
-void sbuf_init(sbuf_t *sp, int n) {
-	sp->buf = Calloc(n, sizeof(int));
-	sp->client_sock = Calloc(n, sizeof(struct sockaddr_in));
-	sp->n = n;					/* Buffer holds max of n items */
-	sp->front = sp->rear = 0;	/* Empty buffer iff front == rear */
-	Sem_init(&sp->mutex, 0, 1);	/* Binary semaphore for locking */
-	Sem_init(&sp->slots, 0, n);	/* Initially, buf has n empty slots */
-	Sem_init(&sp->items, 0 ,0); /* Initially, buf has zero data items */
+	if (pin)
+		pin_cpu(id);
+	while(pool_get(&conn))			/* Remove connfd from buffer */
+		serve(conn);				/* Service client */
+	return NULL;
 }
 
-/* Clean up buffer sp */
-void subf_deinit(sbuf_t *sp) {
-	Free(sp->buf);
-	Free(sp->client_sock);
-}
+/* Thread routine of the acceptor vargp with -r, accepts the connections
+ * of its own listening socket into the buffer. It never serves one
+ * itself, so a client kept open by a worker does not hold up the next
+ * connections of the socket */
+void *acceptor(void *vargp) {
+	Pthread_detach(pthread_self());
+	int id = (int)(long)vargp, connfd;
+	struct sockaddr_in clientaddr;
+	socklen_t clientlen;
 
-/* Insert item onto the rear of shared buffer sp */
-void sbuf_insert(sbuf_t *sp, int item, struct sockaddr_in *client_addr) {
-	P(&sp->slots);							/* Wait for available slot */
-	P(&sp->mutex);							/* Lock the buffer */
-	sp->buf[(++sp->rear)%(sp->n)] = item;	/* Insert the item */
-	memcpy(&sp->client_sock[(sp->rear)%(sp->n)], 
-			client_addr, sizeof(struct sockaddr_in));
-	V(&sp->mutex);							/* Unlock the buffer */
-	V(&sp->items);							/* Announce available item */
+	if (pin)
+		pin_cpu(id);
+	while(1) {
+		clientlen = sizeof(clientaddr);
+		if ((connfd = accept(listenfds[id], (SA *)&clientaddr, &clientlen)) < 0) {
+			if (errno != EINTR && errno != ECONNABORTED)
+				fprintf(stderr, "accept error: %s\n", strerror(errno));
+			continue;
+		}
+		sbuf_insert(&sbuf, connfd, &clientaddr);
+	}
+	return NULL;
 }
 
-conn_t sbuf_remove(sbuf_t *sp) {
-	conn_t result;
-
-	P(&sp->items);							/* Wait for available item */
-	P(&sp->mutex);							/* Lock the buffer */
-	result.fd = sp->buf[(++sp->front)%(sp->n)];	/* Remove item */
-	result.client_sock = sp->client_sock[(sp->front)%(sp->n)];
-	V(&sp->mutex);							/* Unlock the buffer */
-	V(&sp->slots);							/* Announce available slot */
-	return result;
+/* serve - serve the requests of a client until it closes the
+ * connection or leaves it idle for KEEPALIVE_TIMEOUT seconds. The
+ * response goes out in several writes, so Nagle's algorithm is off:
+ * otherwise the last one waits for the delayed ACK of the client */
+void serve(conn_t conn) {
+	struct timeval timeout = { KEEPALIVE_TIMEOUT, 0 };
+	int one = 1;
+	rio_t rio;
+
+	setsockopt(conn.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	metrics_add(METRIC_CONNS_OPENED, 1);
+	Rio_readinitb(&rio, conn.fd);
+	while (doit(conn, &rio))
+		;
+	Close(conn.fd);
+	metrics_add(METRIC_CONNS_CLOSED, 1);
 }
 
+/* pin_cpu - bind the calling thread to CPU i, modulo the CPUs */
+void pin_cpu(int i) {
+	cpu_set_t set;
+	int rc;
 
+	CPU_ZERO(&set);
+	CPU_SET(i % sysconf(_SC_NPROCESSORS_ONLN), &set);
+	if ((rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+		fprintf(stderr, "pthread_setaffinity_np error: %s\n", strerror(rc));
+}
 
 /*
  * parse_uri - URI parser
@@ -204,21 +292,20 @@ int parse_uri(char *uri, char *hostname, char *pathname, int *port)
 /*
  * format_log_entry - Create a formatted log entry in logstring. 
  * 
- * The inputs are the socket address of the requesting client
- * (sockaddr), the URI from the request (uri), and the size in bytes
- * of the response from the server (size).
+ * The inputs are the time of the request (now), the socket address of
+ * the requesting client (sockaddr), the URI from the request (uri), and
+ * the size in bytes of the response from the server (size).
  */
-void format_log_entry(char *logstring, struct sockaddr_in *sockaddr, 
-		      char *uri, int size)
+void format_log_entry(char *logstring, time_t now,
+		      struct sockaddr_in *sockaddr, char *uri, int size)
 {
-    time_t now;
+    struct tm tm;
     char time_str[MAXLINE];
     unsigned long host;
     unsigned char a, b, c, d;
 
     /* Get a formatted time string */
-    now = time(NULL);
-    strftime(time_str, MAXLINE, "%a %d %b %Y %H:%M:%S %Z", localtime(&now));
+    strftime(time_str, MAXLINE, "%a %d %b %Y %H:%M:%S %Z", localtime_r(&now, &tm));
 
     /* 
      * Convert the IP address in network byte order to dotted decimal
@@ -237,73 +324,462 @@ void format_log_entry(char *logstring, struct sockaddr_in *sockaddr,
     sprintf(logstring, "%s: %d.%d.%d.%d %s %d\n", time_str, a, b, c, d, uri, size);
 }
 
+/* header_value - if line is the header name, copy its value without the
+ * surrounding blanks into value, which must hold MAXLINE bytes
+ */
+int header_value(char *line, char *name, char *value) {
+	size_t len = strlen(name);
+	char *end;
+
+	if (strncasecmp(line, name, len) || line[len] != ':')
+		return 0;
+	line += len + 1;
+	while (*line == ' ' || *line == '\t')
+		line++;
+	end = line + strlen(line);
+	while (end > line && isspace((unsigned char)end[-1]))
+		end--;
+	len = end - line < MAXLINE ? end - line : MAXLINE - 1;
+	memcpy(value, line, len);
+	value[len] = '\0';
+	return 1;
+}
+
+/* has_token - whether the header value contains token, ignoring case */
+int has_token(char *value, char *token) {
+	size_t len = strlen(token);
+
+	for (; *value; value++)
+		if (!strncasecmp(value, token, len))
+			return 1;
+	return 0;
+}
+
+/* client_keepalive - whether the client wants the connection kept
+ * open: by default from HTTP/1.1 on, with keep-alive before
+ */
+static int client_keepalive(http_req_t *req) {
+	char value[MAXLINE];
+	http_header_t *h;
+	int keepalive = req->version.len > 0 &&
+		!http_is(req, req->version, "HTTP/1.0");
+
+	if ((h = http_header(req, "Connection")) == NULL)
+		h = http_header(req, "Proxy-Connection");
+	if (h != NULL) {
+		http_copy(req, h->value, value, sizeof(value));
+		if (has_token(value, "close"))
+			keepalive = 0;
+		else if (has_token(value, "keep-alive"))
+			keepalive = 1;
+	}
+	return keepalive;
+}
+
+/* send_client - send n bytes to the client, counting them in total */
+static void send_client(int fd, void *buf, size_t n, size_t *total) {
+	Rio_writen_w(fd, buf, n);
+	*total += n;
+}
+
+/* relay_bytes - copy n bytes of the response body to the client, or
+ * everything up to EOF if n is negative, also into copy unless NULL.
+ * Return 0 if the server closed before n bytes
+ */
+static int relay_bytes(rio_t *rio_s, int clientfd, long long n, size_t *total,
+		char *copy) {
+	char buf[MAXBUF];
+	ssize_t size;
+
+	while (n != 0) {
+		size = (n < 0 || n > sizeof(buf)) ? sizeof(buf) : n;
+		if ((size = Rio_readn_w(rio_s, buf, size)) <= 0)
+			return n < 0;
+		send_client(clientfd, buf, size, total);
+		if (copy != NULL) {
+			memcpy(copy, buf, size);
+			copy += size;
+		}
+		if (n > 0)
+			n -= size;
+	}
+	return 1;
+}
+
+/* relay_pipe_close - close the pipe of an exiting thread */
+static void relay_pipe_close(void *vp) {
+	int *p = vp;
+
+	close(p[0]);
+	close(p[1]);
+	Free(p);
+}
+
+/* relay_pipe_key - create the key of the pipes of the threads */
+static void relay_pipe_key(void) {
+	pthread_key_create(&relay_key, relay_pipe_close);
+}
+
+/* relay_pipe - the pipe of the calling thread for splice, created on
+ * its first use, or NULL if there cannot be one
+ */
+static int *relay_pipe(void) {
+	int *p;
+
+	pthread_once(&relay_once, relay_pipe_key);
+	if ((p = pthread_getspecific(relay_key)) != NULL)
+		return p;
+	p = Malloc(2 * sizeof(int));
+	if (pipe2(p, O_CLOEXEC) < 0) {
+		Free(p);
+		return NULL;
+	}
+	fcntl(p[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);	/* Best effort */
+	pthread_setspecific(relay_key, p);
+	return p;
+}
+
+/* relay_direct - relay_bytes without a copy: the bytes rio already
+ * buffered are sent, then the rest goes from the server socket into
+ * the pipe of the thread and from there to the client with splice,
+ * never through user memory. Return 0 if the server closed before n
+ * bytes, or the client is gone
+ */
+static int relay_direct(rio_t *rio_s, int clientfd, long long n,
+		size_t *total) {
+	long long m;
+	ssize_t in, out;
+	int *p;
+
+	if (rio_s->rio_cnt > 0) {
+		m = (n < 0 || n > rio_s->rio_cnt) ? rio_s->rio_cnt : n;
+		if (!relay_bytes(rio_s, clientfd, m, total, NULL))
+			return 0;
+		if (n > 0 && (n -= m) == 0)
+			return 1;
+	}
+	if ((p = relay_pipe()) == NULL)
+		return relay_bytes(rio_s, clientfd, n, total, NULL);
+
+	while (n != 0) {
+		m = (n < 0 || n > SPLICE_PIPE_SIZE) ? SPLICE_PIPE_SIZE : n;
+		in = splice(rio_s->rio_fd, NULL, p[1], NULL, m,
+				SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (in == 0)
+			return n < 0;
+		if (in < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "splice error: %s\n", strerror(errno));
+			return 0;
+		}
+		if (n > 0)
+			n -= in;
+
+		/* Empty the pipe into the client */
+		while (in > 0) {
+			out = splice(p[0], NULL, clientfd, NULL, in,
+					SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (out < 0 && errno == EINTR)
+				continue;
+			if (out <= 0) {
+				/* Bytes left in the pipe would go to the next client */
+				pthread_setspecific(relay_key, NULL);
+				relay_pipe_close(p);
+				return 0;
+			}
+			in -= out;
+			*total += out;
+		}
+	}
+	return 1;
+}
+
+/* relay_chunked - copy a chunked response body to the client, with its
+ * framing, or only the data of the chunks if dechunk is set.
+ * Return 0 if the server closed before the last chunk
+ */
+static int relay_chunked(rio_t *rio_s, int clientfd, int dechunk,
+		size_t *total) {
+	char line[MAXLINE];
+	long long size;
+	ssize_t n;
+
+	while (1) {
+		if ((n = Rio_readlineb_w(rio_s, line, MAXLINE)) <= 0)
+			return 0;
+		if (!dechunk)
+			send_client(clientfd, line, n, total);
+		if ((size = strtoll(line, NULL, 16)) <= 0)
+			break;
+		if (!relay_direct(rio_s, clientfd, size, total))
+			return 0;
+		/* The CRLF closing the data */
+		if ((n = Rio_readlineb_w(rio_s, line, MAXLINE)) <= 0)
+			return 0;
+		if (!dechunk)
+			send_client(clientfd, line, n, total);
+	}
+
+	/* The trailer, up to the empty line */
+	do {
+		if ((n = Rio_readlineb_w(rio_s, line, MAXLINE)) <= 0)
+			return 0;
+		if (!dechunk)
+			send_client(clientfd, line, n, total);
+	} while (strcmp(line, "\r\n") && strcmp(line, "\n"));
+	return 1;
+}
+
+/* relay_response - relay the response whose status line was read from
+ * the server to the client. The hop-by-hop headers of the server are
+ * replaced with our own Connection header, and the body is relayed
+ * according to its framing, so that its end is found without EOF when
+ * the server gives its length. An HTTP/1.0 client gets chunked bodies
+ * de-chunked. A successful response of known length small enough is
+ * cached under key, without its Connection header, unless key is NULL
+ * or the server sets a cookie or forbids it.
+ * Return whether the client connection can be kept, and in *reusable
+ * whether the server one can
+ */
+static int relay_response(rio_t *rio_s, int clientfd, char *status,
+		int keepalive, int http10, char *key, int *reusable, size_t *total) {
+	char line[MAXLINE], value[MAXLINE], head[MAXBUF], *object = NULL;
+	char connection[32];
+	size_t hlen = 0, slen = strlen(status), n, objsize = 0;
+	long long length = -1;
+	int code = 0, body, chunked = 0, dechunk, server_close, ok = 1;
+	int cacheable = key != NULL;
+
+	sscanf(status, "%*s %d", &code);
+	server_close = !strncasecmp(status, "HTTP/1.0", 8);
+
+	/* Read the headers, keeping the end-to-end ones */
+	while (1) {
+		if (Rio_readlineb_w(rio_s, line, MAXLINE) <= 0) {
+			*reusable = 0;
+			return 0;
+		}
+		if (!strcmp(line, "\r\n") || !strcmp(line, "\n"))
+			break;
+		if (header_value(line, "Connection", value)) {
+			if (has_token(value, "close"))
+				server_close = 1;
+			else if (has_token(value, "keep-alive"))
+				server_close = 0;
+			continue;
+		}
+		if (header_value(line, "Keep-Alive", value) ||
+				header_value(line, "Proxy-Connection", value))
+			continue;
+		if (header_value(line, "Transfer-Encoding", value)) {
+			chunked = has_token(value, "chunked");
+			if (chunked && http10)
+				continue;
+		}
+		else if (header_value(line, "Content-Length", value))
+			length = atoll(value);
+		else if (header_value(line, "Set-Cookie", value))
+			cacheable = 0;
+		else if (header_value(line, "Cache-Control", value) &&
+				(has_token(value, "private") || has_token(value, "no-store")))
+			cacheable = 0;
+
+		n = strlen(line);
+		if (hlen + n > sizeof(head)) {
+			*reusable = 0;
+			return 0;
+		}
+		memcpy(head + hlen, line, n);
+		hlen += n;
+	}
+
+	/* How the end of the body is found */
+	if (code / 100 == 1 || code == 204 || code == 304)
+		body = BODY_NONE;
+	else if (chunked)
+		body = BODY_CHUNKED;
+	else if (length >= 0)
+		body = BODY_LENGTH;
+	else
+		body = BODY_EOF;
+	dechunk = body == BODY_CHUNKED && http10;
+	keepalive = keepalive && body != BODY_EOF && !dechunk;
+	*reusable = !server_close && body != BODY_EOF;
+
+	/* Send the header */
+	snprintf(connection, sizeof(connection), "Connection: %s\r\n",
+			keepalive ? "keep-alive" : "close");
+	send_client(clientfd, status, slen, total);
+	send_client(clientfd, connection, strlen(connection), total);
+	send_client(clientfd, head, hlen, total);
+	send_client(clientfd, "\r\n", 2, total);
+
+	/* Keep a copy of a successful response which fits in the cache */
+	if (cacheable && code == 200 && body == BODY_LENGTH &&
+			slen + hlen + 2 + length <= MAX_OBJECT_SIZE) {
+		objsize = slen + hlen + 2 + length;
+		object = Malloc(objsize);
+		memcpy(object, status, slen);
+		memcpy(object + slen, head, hlen);
+		memcpy(object + slen + hlen, "\r\n", 2);
+	}
+
+	/* The body goes through user memory only to be cached */
+	switch (body) {
+	case BODY_LENGTH:
+		if (object != NULL)
+			ok = relay_bytes(rio_s, clientfd, length, total,
+					object + slen + hlen + 2);
+		else
+			ok = relay_direct(rio_s, clientfd, length, total);
+		break;
+	case BODY_CHUNKED:
+		ok = relay_chunked(rio_s, clientfd, dechunk, total);
+		break;
+	case BODY_EOF:
+		relay_direct(rio_s, clientfd, -1, total);
+		break;
+	}
+
+	if (object != NULL) {
+		if (ok)
+			cache_insert(&cache, key, object, objsize);
+		Free(object);
+	}
+	if (!ok)
+		*reusable = keepalive = 0;
+	return keepalive;
+}
+
+/* send_cached - send a cached response to the client, with the
+ * Connection header after its status line
+ */
+static void send_cached(int clientfd, cache_obj_t *obj, int keepalive,
+		size_t *total) {
+	char *eol = memchr(obj->data, '\n', obj->size);
+	size_t n = eol != NULL ? eol - obj->data + 1 : obj->size;
+	char *connection = keepalive ? "Connection: keep-alive\r\n" :
+			"Connection: close\r\n";
+
+	send_client(clientfd, obj->data, n, total);
+	send_client(clientfd, connection, strlen(connection), total);
+	send_client(clientfd, obj->data + n, obj->size - n, total);
+}
+
 /*
- * doit - manage the request of the client
+ * doit - manage one request of the client
  *
- * The input is the structure containing the fd and sockadddr_in,
- * parse it and send it to the server, then get the response of the
- * server and send it to the client
+ * The input is the structure containing the fd and sockadddr_in, and
+ * the buffer reading from the fd. Parse the request in place with
+ * http.c and send it to the server as HTTP/1.1 with the headers of the
+ * client, on a keep-alive connection of the pool of upstream.c if
+ * there is one, then get the response of the server and
+ * send it to the client. A successful response small enough is copied
+ * into the cache while it is relayed, and served from there the next
+ * time. Return whether the client connection can serve another request
  */
-void doit(conn_t conn) {
-	char buf[MAXLINE], uri[MAXLINE], method[MAXLINE], version[MAXLINE];
+int doit(conn_t conn, rio_t *rio_c) {
+	char buf[MAXLINE], uri[MAXLINE], method[MAXLINE];
 	char hostname[MAXLINE], pathname[MAXLINE];
-	char toserver[MAXLINE], toclient[MAXLINE];
+	char toserver[MAXLINE], key[MAXLINE];
+	http_req_t req;
+	cache_obj_t *obj;
 	int port = 80;	/* default */
-	int serverfd;
+	int serverfd, n, keepalive, http10, reused, reusable, private;
 	int clientfd = conn.fd;
-	size_t size, total = 0;
-	rio_t rio_c, rio_s;
-
-	Rio_readinitb(&rio_c, clientfd);
-
-	/* Get line from the client and parse it */
-	Rio_readlineb_w(&rio_c, buf, MAXLINE);
-	sscanf(buf, "%s %s %s", method, uri, version);
+	size_t total = 0;
+	long start;
+	rio_t rio_s;
+
+	/* Parse the request in the buffer of the client. EOF or the
+	 * keep-alive timeout end the connection quietly */
+	if ((n = http_read_request(rio_c, &req)) <= 0) {
+		if (n < 0)
+			clienterror(clientfd, "request", "400", "Bad Request",
+					"Tiny could not parse the request");
+		return 0;
+	}
+	start = metrics_usec();
+	http_copy(&req, req.method, method, sizeof(method));
+	http_copy(&req, req.uri, uri, sizeof(uri));
+	http10 = req.version.len == 0 || http_is(&req, req.version, "HTTP/1.0");
+	keepalive = client_keepalive(&req);
 
 	/* Determine the method */
 	if (strcasecmp(method, "GET")) {
 		clienterror(clientfd, method, "501", "Not Implemented", 
 				"Tiny does not implement this method");
-		return;
+		return 0;
 	}
 
-	if (parse_uri(uri, hostname, pathname, &port) == -1)
-		return;
+	/* A body is not forwarded, so it would be read as the next request */
+	if (http_has_body(&req)) {
+		clienterror(clientfd, method, "501", "Not Implemented",
+				"Tiny does not forward request bodies");
+		return 0;
+	}
 
-	if ((serverfd = open_clientfd_ts(hostname, port)) < 0) {
-		clienterror(clientfd, method, "403", "The address cannot find",
-				"Tiny cannot get conneted to the address");
-		return;
+	if (parse_uri(uri, hostname, pathname, &port) == -1)
+		return 0;
+
+	/* Serve it from the cache if possible. The responses to the
+	 * requests with credentials may be personal, they are neither
+	 * served from nor put in the cache */
+	cache_key(key, hostname, port, pathname);
+	private = http_has_credentials(&req);
+	if (!private && (obj = cache_lookup(&cache, key)) != NULL) {
+		send_cached(clientfd, obj, keepalive, &total);
+		write_log(conn.client_sock, uri, total);
+		cache_release(obj);
+		metrics_add(METRIC_CACHE_HITS, 1);
+		metrics_add(METRIC_BYTES, total);
+		metrics_time(METRIC_REQUEST, metrics_usec() - start);
+		return keepalive;
 	}
-	
-	sprintf(toserver, "%s /%s HTTP/1.0\n", method, pathname);
-	sprintf(toserver, "%sHost: %s\n\r\n", toserver, hostname);
-	/* Send the request to the server */
-	Rio_writen_w(serverfd, toserver, strlen(toserver));
-	
-	Rio_readinitb(&rio_s, serverfd);
-	/* Get the response from the server and send them to the client */
-	while((size = Rio_readn_w(&rio_s, toclient, MAXLINE)) > 0) {
-		Rio_writen_w(clientfd, toclient, size);
-		total += size;
+	metrics_add(METRIC_CACHE_MISSES, 1);
+
+	/* The request line and the headers of the proxy, the ones of the
+	 * client follow */
+	if (port == 80)
+		n = snprintf(toserver, sizeof(toserver), "%s /%s HTTP/1.1\r\n"
+				"Host: %s\r\nConnection: keep-alive\r\n",
+				method, pathname, hostname);
+	else
+		n = snprintf(toserver, sizeof(toserver), "%s /%s HTTP/1.1\r\n"
+				"Host: %s:%d\r\nConnection: keep-alive\r\n",
+				method, pathname, hostname, port);
+	if (n >= sizeof(toserver))
+		return 0;
+
+	/* Send the request to the server and read the status line. A pooled
+	 * connection the server closed meanwhile is retried on a new one */
+	while (1) {
+		if ((serverfd = upstream_get(hostname, port, &reused)) < 0) {
+			clienterror(clientfd, method, "403", "The address cannot find",
+					"Tiny cannot get conneted to the address");
+			return 0;
+		}
+		Rio_readinitb(&rio_s, serverfd);
+		if (http_forward(serverfd, &req, toserver, n) == 0 &&
+				rio_readlineb(&rio_s, buf, MAXLINE) > 0)
+			break;
+		Close(serverfd);
+		if (!reused)
+			return 0;
 	}
+
+	keepalive = relay_response(&rio_s, clientfd, buf, keepalive, http10,
+			private ? NULL : key, &reusable, &total);
 	/* Write the information to the log*/
 	write_log(conn.client_sock, uri, total);
-	Close(serverfd);
-}
-
-/* write_log - write information to the log file
- * The input is the structure of sockaddr_in, uri and the size of the content
- * getting from the server
- */
-void write_log(struct sockaddr_in client_sock, char *uri, int size) {
-	char logstring[MAXLINE];
-	format_log_entry(logstring, &client_sock, uri, size);
-	P(&mutex_log);						/* Lock the file */
-	logfile = fopen("proxy.log", "a+");	/* Open the file */
-	fprintf(logfile, "%s", logstring);	/* Write it */
-	fclose(logfile);					/* Close file */
-	V(&mutex_log);						/* Unlock it */
+	metrics_add(METRIC_BYTES, total);
+	metrics_time(METRIC_REQUEST, metrics_usec() - start);
+	if (reusable)
+		upstream_put(hostname, port, serverfd);
+	else
+		Close(serverfd);
+	return keepalive;
 }
 
 /* clienterror - Send the error information to the client
@@ -313,54 +789,58 @@ void write_log(struct sockaddr_in client_sock, char *uri, int size) {
 void clienterror(int fd, char *cause, char *errnum,
 		char *shortmsg, char*longmsg) {
 	char buf[MAXLINE], body[MAXBUF];
+	int n;
 	
 	/* Build the HTTP response body */
-	sprintf(body, "<html><title>Tiny Error</title>");
-	sprintf(body, "%s<body bgcolor=""ffffff"">\r\n", body);
-	sprintf(body, "%s%s: %s\r\n", body, longmsg, cause);
-	sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-	sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body);
+	n = snprintf(body, sizeof(body), "<html><title>Tiny Error</title>"
+			"<body bgcolor=""ffffff"">\r\n"
+			"%s: %s\r\n"
+			"<p>%s: %s\r\n"
+			"<hr><em>The Tiny Web server</em>\r\n",
+			longmsg, cause, longmsg, cause);
+	if (n >= sizeof(body))
+		n = sizeof(body) - 1;
 
 	/* Print the HTTP response */
-	sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
+	snprintf(buf, sizeof(buf), "HTTP/1.0 %s %s\r\n"
+			"Content-type: text/html\r\n"
+			"Content-length: %d\r\n\r\n", errnum, shortmsg, n);
 	Rio_writen_w(fd, buf, strlen(buf));
-	sprintf(buf, "Content-type: text/html\r\n");
-	Rio_writen_w(fd, buf, strlen(buf));
-	sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-	Rio_writen_w(fd, buf, strlen(buf));
-	Rio_writen_w(fd, body, strlen(body));
+	Rio_writen_w(fd, body, n);
+}
+
+/* resolve_host - fill in the address of the server at hostname:port,
+ * resolving it through the cache of dns.c.
+ * Return -2 if the host cannot be resolved
+ */
+int resolve_host(char *hostname, int port, struct sockaddr_in *serveraddr) {
+	bzero((char *) serveraddr, sizeof(*serveraddr));
+	serveraddr->sin_family = AF_INET;
+	serveraddr->sin_port = htons(port);
+	return dns_resolve(hostname, &serveraddr->sin_addr);
 }
 
-/* open_clientfd_ts - use the lock-and-copy technique
- * when it calls gethostbyaddr to avoid data race
+/* open_clientfd_ts - the thread-safe open_clientfd, resolve the
+ * hostname with resolve_host and connect to it
  */
 int open_clientfd_ts(char *hostname, int port) {
 	int clientfd;
-	struct hostent *hp;
 	struct sockaddr_in serveraddr;
+	long start;
+
+	if (resolve_host(hostname, port, &serveraddr) < 0)
+		return -2;
 
 	if ((clientfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
 		return -1;			/* Check errno for cause of error */
-
-	P(&mutex_get_host);		/* Lock it */
-
-	/* Fill in the server's IP address and port */
-	if ((hp = gethostbyname(hostname)) == NULL) {
-		V(&mutex_get_host);	/* Unlock it */
-		return -2;			/* Check h_errno for cause of error */
-	}
-
-	V(&mutex_get_host);		/* Unlock it */
-
-	bzero((char *) &serveraddr, sizeof(serveraddr));
-	serveraddr.sin_family = AF_INET;
-	bcopy((char *)hp->h_addr_list[0], 
-			(char *)&serveraddr.sin_addr.s_addr, hp->h_length);
-	serveraddr.sin_port = htons(port);
 	
 	/* Establish a connection with the server */
-	if (connect(clientfd, (SA *) &serveraddr, sizeof(serveraddr)) < 0)
+	start = metrics_usec();
+	if (connect(clientfd, (SA *) &serveraddr, sizeof(serveraddr)) < 0) {
+		close(clientfd);
 		return -1;
+	}
+	metrics_time(METRIC_CONNECT, metrics_usec() - start);
 	return clientfd;
 }
 
@@ -0,0 +1,170 @@
+/*
+ * proxy.h - Declarations shared by the modules of the proxy
+ */
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#include <sys/uio.h>
+#include "csapp.h"
+
+/* Recommended max cache and object sizes */
+#define MAX_CACHE_SIZE	1049000
+#define MAX_OBJECT_SIZE	102400
+
+#define CACHE_BUCKETS	1024
+#define CACHE_SAMPLE	8				/* Objects compared per eviction */
+
+typedef struct cache_obj {
+	char *key;							/* Normalized URI */
+	char *data;							/* The whole response */
+	size_t size;
+	unsigned long stamp;				/* Clock of the last use */
+	int refs;							/* The cache and the readers */
+	struct cache_obj *next;				/* Next in the bucket */
+	struct cache_obj *prev_all;			/* Ring of all objects */
+	struct cache_obj *next_all;
+} cache_obj_t;
+
+typedef struct {
+	pthread_rwlock_t lock;				/* Read to look up, write to change */
+	cache_obj_t *buckets[CACHE_BUCKETS];
+	size_t size;						/* Bytes of all objects */
+	size_t max_size;
+	size_t max_object;
+	unsigned long clock;				/* Bumped on every use */
+	cache_obj_t *hand;					/* Where eviction looks next */
+} cache_t;
+
+typedef struct {
+	/* Some information of client */
+	int fd;
+	struct sockaddr_in client_sock;
+} conn_t;
+
+/* Wakeups of threads parked on a futex in sbuf.c */
+typedef struct {
+	unsigned seq;						/* The futex, bumped to wake */
+	int waiters;
+} sbuf_event_t;
+
+typedef struct {
+	size_t seq;							/* Position the slot is ready for */
+	conn_t conn;
+} sbuf_cell_t;
+
+typedef struct {
+	sbuf_cell_t *cells;
+	size_t mask;						/* Slots - 1, a power of 2 */
+	size_t enqueue_pos __attribute__((aligned(64)));
+	size_t dequeue_pos __attribute__((aligned(64)));
+	sbuf_event_t items __attribute__((aligned(64)));	/* Workers waiting */
+	sbuf_event_t slots;					/* The acceptor waiting */
+} sbuf_t;
+
+#define HTTP_MAX_HEADERS	64
+
+/* Bytes of a request head, where http.c found something */
+typedef struct {
+	unsigned short off;
+	unsigned short len;
+} http_slice_t;
+
+typedef struct {
+	http_slice_t line;					/* The whole line, with its CRLF */
+	http_slice_t name;
+	http_slice_t value;					/* Without the surrounding blanks */
+} http_header_t;
+
+typedef struct {
+	char *base;							/* The head, in the buffer of rio */
+	http_slice_t method;
+	http_slice_t uri;
+	http_slice_t version;				/* Empty for HTTP/0.9 */
+	http_header_t headers[HTTP_MAX_HEADERS];
+	int nheaders;
+} http_req_t;
+
+/* Counters of metrics.c */
+#define METRIC_CONNS_OPENED		0
+#define METRIC_CONNS_CLOSED		1
+#define METRIC_CACHE_HITS		2
+#define METRIC_CACHE_MISSES		3
+#define METRIC_BYTES			4	/* Relayed to the clients */
+#define METRIC_UPSTREAM_REUSED	5
+#define METRIC_COUNTERS			6
+
+/* Histograms of metrics.c, of METRIC_BUCKETS buckets */
+#define METRIC_REQUEST			0
+#define METRIC_CONNECT			1	/* To a server */
+#define METRIC_DNS				2
+#define METRIC_HISTOGRAMS		3
+#define METRIC_BUCKETS			20
+
+/* proxy.c */
+extern cache_t cache;
+int parse_uri(char *uri, char *target_addr, char *path, int  *port);
+void format_log_entry(char *logstring, time_t now, struct sockaddr_in *sockaddr, char *uri, int size);
+void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
+int resolve_host(char *hostname, int port, struct sockaddr_in *serveraddr);
+int open_clientfd_ts(char *hostname, int port);
+void pin_cpu(int i);
+int header_value(char *line, char *name, char *value);
+int has_token(char *value, char *token);
+
+ssize_t Rio_readlineb_w(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t Rio_readn_w(rio_t *rp, void *usrbuf, size_t nbytes);
+void Rio_writen_w(int fd, void *usrbuf, size_t n);
+
+/* cache.c */
+void cache_init(cache_t *cp, size_t max_size, size_t max_object);
+void cache_key(char *key, char *hostname, int port, char *pathname);
+cache_obj_t *cache_lookup(cache_t *cp, char *key);
+void cache_release(cache_obj_t *obj);
+void cache_insert(cache_t *cp, char *key, char *data, size_t size);
+
+/* dns.c */
+void dns_init(void);
+int dns_resolve(char *hostname, struct in_addr *addr);
+
+/* http.c */
+int http_read_request(rio_t *rp, http_req_t *req);
+int http_is(http_req_t *req, http_slice_t s, char *str);
+char *http_copy(http_req_t *req, http_slice_t s, char *dst, size_t size);
+http_header_t *http_header(http_req_t *req, char *name);
+int http_has_body(http_req_t *req);
+int http_has_credentials(http_req_t *req);
+int http_head_iov(http_req_t *req, char *head, size_t headlen,
+		struct iovec *iov);
+int http_forward(int fd, http_req_t *req, char *head, size_t headlen);
+
+/* upstream.c */
+void upstream_init(void);
+int upstream_get(char *hostname, int port, int *reused);
+void upstream_put(char *hostname, int port, int fd);
+
+/* sbuf.c */
+void sbuf_init(sbuf_t *sp, int n);
+void sbuf_deinit(sbuf_t *sp);
+void sbuf_insert(sbuf_t *sp, int item, struct sockaddr_in *client_sock);
+conn_t sbuf_remove(sbuf_t *sp);
+int sbuf_depth(sbuf_t *sp);
+
+/* pool.c */
+void pool_init(sbuf_t *sp, int min, int max, void *(*routine)(void *));
+int pool_get(conn_t *conn);
+int pool_workers(void);
+
+/* log.c */
+void log_init(char *path);
+void write_log(struct sockaddr_in client_sock, char *uri, int size);
+
+/* metrics.c */
+void metrics_init(int port, sbuf_t *sp);
+void metrics_add(int counter, unsigned long n);
+void metrics_time(int hist, long usec);
+long metrics_usec(void);
+
+/* event.c */
+void event_main(int *listenfds, int nloops, int pin);
+
+#endif /* __PROXY_H__ */
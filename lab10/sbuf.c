@@ -0,0 +1,170 @@
+/*
+ * sbuf.c - Bounded queue of accepted connections
+ *
+ * The acceptor inserts connections and the worker threads remove them
+ * through a lock-free ring of the kind of D. Vyukov's bounded MPMC
+ * queue: every slot carries a sequence number telling whether it is
+ * free for the insert at a position or full for the remove at it, so
+ * a handoff is one compare-and-swap on the position plus a store of
+ * the sequence, and never takes a lock.
+ *
+ * A worker that finds the ring empty spins briefly, then parks on a
+ * futex. An insert only makes the futex system call when a worker is
+ * parked; likewise for the acceptor parked on a full ring.
+ */
+#define _GNU_SOURCE	/* syscall() */
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "proxy.h"
+
+#define SBUF_SPIN	100		/* Tries before parking */
+
+/* sbuf_futex_wait - sleep while *addr is val */
+static void sbuf_futex_wait(unsigned *addr, unsigned val) {
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+/* sbuf_futex_wake - wake up a thread sleeping on addr */
+static void sbuf_futex_wake(unsigned *addr) {
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* sbuf_park - sleep until the other side signals ev with sbuf_unpark,
+ * unless try succeeds first. Return 1 if it did
+ */
+static int sbuf_park(sbuf_t *sp, sbuf_event_t *ev, conn_t *conn,
+		int (*try)(sbuf_t *, conn_t *)) {
+	unsigned seq = __atomic_load_n(&ev->seq, __ATOMIC_SEQ_CST);
+
+	__atomic_add_fetch(&ev->waiters, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	/* Try again now that the other side can see we are waiting */
+	if (try(sp, conn)) {
+		__atomic_sub_fetch(&ev->waiters, 1, __ATOMIC_SEQ_CST);
+		return 1;
+	}
+	sbuf_futex_wait(&ev->seq, seq);
+	__atomic_sub_fetch(&ev->waiters, 1, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+/* sbuf_unpark - wake up a thread parked for the event, if any */
+static void sbuf_unpark(sbuf_event_t *ev) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ev->waiters, __ATOMIC_SEQ_CST) > 0) {
+		__atomic_add_fetch(&ev->seq, 1, __ATOMIC_SEQ_CST);
+		sbuf_futex_wake(&ev->seq);
+	}
+}
+
+/* sbuf_try_insert - insert conn unless the ring is full */
+static int sbuf_try_insert(sbuf_t *sp, conn_t *conn) {
+	size_t pos = __atomic_load_n(&sp->enqueue_pos, __ATOMIC_RELAXED);
+	sbuf_cell_t *cell;
+	long dif;
+
+	while (1) {
+		cell = &sp->cells[pos & sp->mask];
+		dif = (long)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long)pos;
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&sp->enqueue_pos, &pos, pos + 1, 1,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (dif < 0)
+			return 0;		/* Full */
+		else
+			pos = __atomic_load_n(&sp->enqueue_pos, __ATOMIC_RELAXED);
+	}
+	cell->conn = *conn;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_SEQ_CST);
+	return 1;
+}
+
+/* sbuf_try_remove - remove the first connection into conn unless the
+ * ring is empty
+ */
+static int sbuf_try_remove(sbuf_t *sp, conn_t *conn) {
+	size_t pos = __atomic_load_n(&sp->dequeue_pos, __ATOMIC_RELAXED);
+	sbuf_cell_t *cell;
+	long dif;
+
+	while (1) {
+		cell = &sp->cells[pos & sp->mask];
+		dif = (long)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long)(pos + 1);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&sp->dequeue_pos, &pos, pos + 1, 1,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (dif < 0)
+			return 0;		/* Empty */
+		else
+			pos = __atomic_load_n(&sp->dequeue_pos, __ATOMIC_RELAXED);
+	}
+	*conn = cell->conn;
+	__atomic_store_n(&cell->seq, pos + sp->mask + 1, __ATOMIC_SEQ_CST);
+	return 1;
+}
+
+/* sbuf_init - create an empty ring of at least n slots, rounded up to
+ * a power of 2. With a single slot, full and free would have the same
+ * sequence number, so there are at least 2
+ */
+void sbuf_init(sbuf_t *sp, int n) {
+	size_t size = 2, i;
+
+	while (size < n)
+		size <<= 1;
+	sp->cells = Calloc(size, sizeof(sbuf_cell_t));
+	for (i = 0; i < size; i++)
+		sp->cells[i].seq = i;
+	sp->mask = size - 1;
+	sp->enqueue_pos = sp->dequeue_pos = 0;
+	memset(&sp->items, 0, sizeof(sp->items));
+	memset(&sp->slots, 0, sizeof(sp->slots));
+}
+
+/* sbuf_deinit - clean up the ring */
+void sbuf_deinit(sbuf_t *sp) {
+	Free(sp->cells);
+}
+
+/* sbuf_insert - insert the connection at the rear of the ring, waiting
+ * for a free slot if it is full
+ */
+void sbuf_insert(sbuf_t *sp, int item, struct sockaddr_in *client_addr) {
+	conn_t conn;
+	int i;
+
+	conn.fd = item;
+	conn.client_sock = *client_addr;
+	for (i = 0; !sbuf_try_insert(sp, &conn); i++)
+		if (i >= SBUF_SPIN && sbuf_park(sp, &sp->slots, &conn, sbuf_try_insert))
+			break;
+	sbuf_unpark(&sp->items);
+}
+
+/* sbuf_remove - remove the connection at the front of the ring, waiting
+ * for one if it is empty
+ */
+conn_t sbuf_remove(sbuf_t *sp) {
+	conn_t conn;
+	int i;
+
+	for (i = 0; !sbuf_try_remove(sp, &conn); i++)
+		if (i >= SBUF_SPIN && sbuf_park(sp, &sp->items, &conn, sbuf_try_remove))
+			break;
+	sbuf_unpark(&sp->slots);
+	return conn;
+}
+
+/* sbuf_depth - the number of connections waiting in the ring, which
+ * may be stale as soon as it is returned
+ */
+int sbuf_depth(sbuf_t *sp) {
+	size_t deq = __atomic_load_n(&sp->dequeue_pos, __ATOMIC_RELAXED);
+	size_t enq = __atomic_load_n(&sp->enqueue_pos, __ATOMIC_RELAXED);
+
+	return enq > deq ? enq - deq : 0;
+}
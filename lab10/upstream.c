@@ -0,0 +1,154 @@
+/*
+ * upstream.c - Pool of idle keep-alive connections to the servers
+ *
+ * After a response whose end was known without EOF, doit hands the
+ * connection to the server back with upstream_put instead of closing
+ * it, and the next request to the same host and port takes it with
+ * upstream_get instead of connecting again. As in dns.c, idle
+ * connections are kept in shards by hash of the origin, each with its
+ * own lock, at most UPSTREAM_MAX_IDLE per origin for UPSTREAM_IDLE_TTL
+ * seconds. A connection the server closed while idle is noticed with
+ * a non-blocking peek before it is handed out.
+ */
+#include "proxy.h"
+
+#define UPSTREAM_SHARDS		16
+#define UPSTREAM_MAX_IDLE	8	/* Idle connections kept per origin */
+#define UPSTREAM_IDLE_TTL	30	/* Seconds an idle connection is kept */
+
+typedef struct upstream_conn {
+	char key[MAXLINE];					/* host:port of the server */
+	int fd;
+	time_t idle_since;
+	struct upstream_conn *next;
+} upstream_conn_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	upstream_conn_t *idle;				/* Most recently used first */
+} upstream_shard_t;
+
+static upstream_shard_t shards[UPSTREAM_SHARDS];
+
+/* upstream_now - seconds of the monotonic clock */
+static time_t upstream_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/* upstream_key - the origin hostname:port in lower case, and its shard */
+static upstream_shard_t *upstream_key(char *key, char *hostname, int port) {
+	unsigned long h = 5381;
+	char *p;
+
+	snprintf(key, MAXLINE, "%s:%d", hostname, port);
+	for (p = key; *p; p++) {
+		*p = tolower(*p);
+		h = h * 33 + (unsigned char)*p;
+	}
+	return &shards[h % UPSTREAM_SHARDS];
+}
+
+/* upstream_alive - whether the idle connection can still be used: the
+ * server neither closed it nor sent anything unasked
+ */
+static int upstream_alive(int fd) {
+	char c;
+
+	return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 &&
+		(errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/* upstream_init - initialize the empty pool */
+void upstream_init(void) {
+	int i;
+
+	for (i = 0; i < UPSTREAM_SHARDS; i++) {
+		pthread_mutex_init(&shards[i].lock, NULL);
+		shards[i].idle = NULL;
+	}
+}
+
+/* upstream_get - a connection to hostname:port, an idle one of the
+ * pool if there is a live one, else a new one. *reused tells which.
+ * Return a negative value like open_clientfd_ts on failure
+ */
+int upstream_get(char *hostname, int port, int *reused) {
+	char key[MAXLINE];
+	upstream_shard_t *sp = upstream_key(key, hostname, port);
+	upstream_conn_t **pp, *uc;
+	time_t now = upstream_now();
+	int fd;
+
+	while (1) {
+		pthread_mutex_lock(&sp->lock);
+		for (pp = &sp->idle; *pp != NULL; pp = &(*pp)->next)
+			if (!strcmp((*pp)->key, key))
+				break;
+		if ((uc = *pp) != NULL)
+			*pp = uc->next;
+		pthread_mutex_unlock(&sp->lock);
+
+		if (uc == NULL)
+			break;
+		fd = uc->fd;
+		if (now - uc->idle_since < UPSTREAM_IDLE_TTL && upstream_alive(fd)) {
+			Free(uc);
+			*reused = 1;
+			metrics_add(METRIC_UPSTREAM_REUSED, 1);
+			return fd;
+		}
+		close(fd);
+		Free(uc);
+	}
+
+	*reused = 0;
+	return open_clientfd_ts(hostname, port);
+}
+
+/* upstream_put - keep the connection to hostname:port for a later
+ * request, closing it if the origin already has enough idle ones.
+ * Connections idle for too long are closed on the way
+ */
+void upstream_put(char *hostname, int port, int fd) {
+	char key[MAXLINE];
+	upstream_shard_t *sp = upstream_key(key, hostname, port);
+	upstream_conn_t **pp, *uc, *expired = NULL;
+	time_t now = upstream_now();
+	int count = 0;
+
+	pthread_mutex_lock(&sp->lock);
+	pp = &sp->idle;
+	while ((uc = *pp) != NULL) {
+		if (now - uc->idle_since >= UPSTREAM_IDLE_TTL) {
+			*pp = uc->next;
+			uc->next = expired;
+			expired = uc;
+			continue;
+		}
+		if (!strcmp(uc->key, key))
+			count++;
+		pp = &uc->next;
+	}
+
+	if (count < UPSTREAM_MAX_IDLE) {
+		uc = Malloc(sizeof(upstream_conn_t));
+		strcpy(uc->key, key);
+		uc->fd = fd;
+		uc->idle_since = now;
+		uc->next = sp->idle;
+		sp->idle = uc;
+		fd = -1;
+	}
+	pthread_mutex_unlock(&sp->lock);
+
+	if (fd >= 0)
+		close(fd);
+	while ((uc = expired) != NULL) {
+		expired = uc->next;
+		close(uc->fd);
+		Free(uc);
+	}
+}
@@ -0,0 +1,211 @@
+/*
+ * autotune.c - Searches the configurations of the blocked transpose
+ *     trans_param() for the one with the fewest misses on a given
+ *     cache, and saves it for trans_tuned() to use.
+ *
+ * Every configuration runs in process: trans.c is built with
+ * -DTRACE_TRANS, so its accesses to A and B feed the cache model of
+ * csim directly and a whole search takes a second or so.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include "cachelab.h"
+#include "cachesim.h"
+
+/* Maximum array dimension */
+#define MAXN 256
+
+/* Number of best configurations printed */
+#define TOP_TUNINGS 5
+
+/* External functions defined in trans.c */
+extern void trans_param(int M, int N, int A[N][M], int B[M][N], tune_t *cfg);
+extern int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+
+/* Values searched for every parameter */
+static int tile_sizes[] = {1, 2, 4, 8, 16, 32};
+static int depths[] = {1, 2, 4, 8};
+
+/* Globals set on the command line */
+static int M = 0;
+static int N = 0;
+
+static int A[MAXN][MAXN];
+static int B[MAXN][MAXN];
+static Cache_t cache;
+
+/*
+ * trace_to_cache - Feed an access of trans_param to the model
+ */
+void trace_to_cache(void *addr, int size, char op)
+{
+    cache_access(&cache, (unsigned long)addr);
+}
+
+/*
+ * evaluate - Run the configuration on the model, record its misses in
+ *     cfg. Return 0 if it does not transpose correctly.
+ */
+int evaluate(tune_t *cfg)
+{
+    initMatrix(M, N, A, B);
+    cache_reset(&cache);
+    setTraceHook(trace_to_cache);
+    trans_param(M, N, A, B, cfg);
+    setTraceHook(NULL);
+
+    cfg->misses = cache.misses;
+    return is_transpose(M, N, A, B);
+}
+
+/*
+ * insert_top - Keep the TOP_TUNINGS configurations with fewest misses
+ *     in top, sorted
+ */
+void insert_top(tune_t *top, int *count, tune_t *cfg)
+{
+    int i = *count < TOP_TUNINGS ? (*count)++ : TOP_TUNINGS;
+
+    for (; i > 0 && top[i-1].misses > cfg->misses; i--) {
+        if (i < TOP_TUNINGS)
+            top[i] = top[i-1];
+    }
+    if (i < TOP_TUNINGS)
+        top[i] = *cfg;
+}
+
+/*
+ * print_tuning - Print one configuration
+ */
+void print_tuning(tune_t *cfg)
+{
+    printf("tile %2dx%-2d tiles by %s, walk %s, diag %s, depth %d: misses:%u\n",
+           cfg->tile_rows, cfg->tile_cols,
+           cfg->order & TUNE_TILES_BY_COL ? "col" : "row",
+           cfg->order & TUNE_WALK_COLS ? "cols" : "rows",
+           cfg->diag ? "last" : "in order", cfg->depth, cfg->misses);
+}
+
+/*
+ * usage - Print usage info
+ */
+void usage(char *argv[]){
+    printf("Usage: %s [-hv] -M <rows> -N <cols> [-s <s> -E <E> -b <b>] [-o <file>]\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -v          Print every configuration tried.\n");
+    printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
+    printf("  -N <cols>   Number of matrix columns (max %d)\n", MAXN);
+    printf("  -s <s>      Set index bits of the cache (default 5)\n");
+    printf("  -E <E>      Associativity of the cache (default 1)\n");
+    printf("  -b <b>      Block bits of the cache (default 5)\n");
+    printf("  -o <file>   File to save the best configuration (default %s)\n", TUNE_FILE);
+    printf("Example: %s -M 64 -N 64\n", argv[0]);
+}
+
+/*
+ * main - Main routine
+ */
+int main(int argc, char* argv[])
+{
+    char c;
+    int s = 5, E = 1, b = 5, verbose = 0;
+    char *filename = TUNE_FILE;
+    tune_t cfg, top[TOP_TUNINGS];
+    int ntop = 0, tried = 0;
+    int tr, tc, order, diag, depth;
+
+    while ((c = getopt(argc,argv,"M:N:s:E:b:o:hv")) != -1) {
+        switch(c) {
+        case 'M':
+            M = atoi(optarg);
+            break;
+        case 'N':
+            N = atoi(optarg);
+            break;
+        case 's':
+            s = atoi(optarg);
+            break;
+        case 'E':
+            E = atoi(optarg);
+            break;
+        case 'b':
+            b = atoi(optarg);
+            break;
+        case 'o':
+            filename = optarg;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+
+    if (M <= 0 || N <= 0 || M > MAXN || N > MAXN) {
+        printf("Error: M and N must be between 1 and %d\n", MAXN);
+        usage(argv);
+        exit(1);
+    }
+
+    cache_init(&cache, s, E, b);
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.M = M;
+    cfg.N = N;
+    cfg.s = s;
+    cfg.E = E;
+    cfg.b = b;
+
+    /* Try every combination, tiles larger than the matrix are the
+       same as the whole matrix and are skipped */
+    for (tr = 0; tr < sizeof(tile_sizes) / sizeof(int); tr++) {
+        if (tr > 0 && tile_sizes[tr-1] >= N)
+            break;
+        for (tc = 0; tc < sizeof(tile_sizes) / sizeof(int); tc++) {
+            if (tc > 0 && tile_sizes[tc-1] >= M)
+                break;
+            for (order = 0; order < 4; order++) {
+                for (diag = 0; diag < 2; diag++) {
+                    for (depth = 0; depth < sizeof(depths) / sizeof(int); depth++) {
+                        cfg.tile_rows = tile_sizes[tr];
+                        cfg.tile_cols = tile_sizes[tc];
+                        cfg.order = order;
+                        cfg.diag = diag;
+                        cfg.depth = depths[depth];
+
+                        if (!evaluate(&cfg)) {
+                            printf("Error: wrong transpose with ");
+                            print_tuning(&cfg);
+                            exit(1);
+                        }
+                        if (verbose)
+                            print_tuning(&cfg);
+                        insert_top(top, &ntop, &cfg);
+                        tried++;
+                    }
+                }
+            }
+        }
+    }
+    cache_free(&cache);
+
+    printf("Tried %d configurations for %dx%d (s=%d, E=%d, b=%d), best:\n",
+           tried, M, N, s, E, b);
+    for (tr = 0; tr < ntop; tr++)
+        print_tuning(&top[tr]);
+
+    if (saveTuning(filename, &top[0]) < 0) {
+        printf("Error: cannot save the configuration to %s\n", filename);
+        exit(1);
+    }
+    printf("Saved to %s\n", filename);
+    return 0;
+}
@@ -10,6 +10,9 @@
 trans_func_t func_list[MAX_TRANS_FUNCS];
 int func_counter = 0; 
 
+kernel_func_t kernel_list[MAX_KERNEL_FUNCS];
+int kernel_counter = 0;
+
 /* 
  * printSummary - Summarize the cache simulation statistics. Student cache simulators
  *                must call this function in order to be properly autograded. 
@@ -81,3 +84,122 @@ void registerTransFunction(void (*trans)(int M, int N, int[N][M], int[M][N]),
     func_list[func_counter].num_evictions =0;
     func_counter++;
 }
+
+/*
+ * registerKernelFunction - Add the given kernel of kernels.c into the
+ *     list of kernels to be tested
+ */
+void registerKernelFunction(kernel_t kernel, kernel_check_t check, char* desc)
+{
+    assert(kernel_counter < MAX_KERNEL_FUNCS);
+    kernel_list[kernel_counter].func_ptr = kernel;
+    kernel_list[kernel_counter].check = check;
+    kernel_list[kernel_counter].description = desc;
+    kernel_list[kernel_counter].correct = 0;
+    kernel_list[kernel_counter].num_hits = 0;
+    kernel_list[kernel_counter].num_misses = 0;
+    kernel_list[kernel_counter].num_evictions = 0;
+    kernel_list[kernel_counter].seconds = 0;
+    kernel_counter++;
+}
+
+/* The configurations loaded by loadTuning */
+static tune_t tune_list[MAX_TUNINGS];
+static int tune_counter = 0;
+
+/*
+ * readTuning - Read the configurations of the file into list, return
+ *     how many, 0 if the file does not exist. A line of the file is
+ *     "M N tile_rows tile_cols order diag depth s E b misses". Lines
+ *     with an empty tile or a depth out of 1..TUNE_MAX_DEPTH are
+ *     skipped, trans_param() could not run them.
+ */
+static int readTuning(char *filename, tune_t *list)
+{
+    FILE *fp = fopen(filename, "r");
+    tune_t *t;
+    int n = 0;
+
+    if (fp == NULL)
+        return 0;
+    while (n < MAX_TUNINGS) {
+        t = &list[n];
+        if (fscanf(fp, "%d %d %d %d %d %d %d %d %d %d %u", &t->M, &t->N,
+                   &t->tile_rows, &t->tile_cols, &t->order, &t->diag,
+                   &t->depth, &t->s, &t->E, &t->b, &t->misses) != 11)
+            break;
+        if (t->tile_rows <= 0 || t->tile_cols <= 0 ||
+            t->depth < 1 || t->depth > TUNE_MAX_DEPTH)
+            continue;
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+/*
+ * loadTuning - Load the configurations saved by autotune
+ */
+int loadTuning(char *filename)
+{
+    tune_counter = readTuning(filename, tune_list);
+    return tune_counter;
+}
+
+/*
+ * findTuning - Return the loaded configuration of the shape, or NULL
+ */
+tune_t *findTuning(int M, int N)
+{
+    int i;
+
+    for (i = 0; i < tune_counter; i++) {
+        if (tune_list[i].M == M && tune_list[i].N == N)
+            return &tune_list[i];
+    }
+    return NULL;
+}
+
+/*
+ * saveTuning - Save the configuration in the file, it replaces the
+ *     previous configuration of the same shape
+ */
+int saveTuning(char *filename, tune_t *cfg)
+{
+    tune_t list[MAX_TUNINGS];
+    int i, n = readTuning(filename, list);
+    FILE *fp;
+
+    for (i = 0; i < n; i++) {
+        if (list[i].M == cfg->M && list[i].N == cfg->N)
+            break;
+    }
+    if (i == MAX_TUNINGS)
+        return -1;
+    list[i] = *cfg;
+    if (i == n)
+        n++;
+
+    if ((fp = fopen(filename, "w")) == NULL)
+        return -1;
+    for (i = 0; i < n; i++) {
+        fprintf(fp, "%d %d %d %d %d %d %d %d %d %d %u\n", list[i].M, list[i].N,
+                list[i].tile_rows, list[i].tile_cols, list[i].order,
+                list[i].diag, list[i].depth, list[i].s, list[i].E, list[i].b,
+                list[i].misses);
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* The hook which receives the traced accesses */
+trace_hook_t trace_hook = NULL;
+
+/*
+ * setTraceHook - Set the hook which receives the accesses of the
+ *     transpose functions compiled with -DTRACE_TRANS
+ */
+void setTraceHook(trace_hook_t hook)
+{
+    trace_hook = hook;
+}
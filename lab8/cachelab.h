@@ -6,6 +6,18 @@
 #define CACHELAB_TOOLS_H
 
 #define MAX_TRANS_FUNCS 100
+#define MAX_KERNEL_FUNCS 100
+#define MAX_TUNINGS 100
+
+/* File where autotune saves the best configuration of every shape */
+#define TUNE_FILE "tune.conf"
+
+/* Bits of the order field of tune_t */
+#define TUNE_TILES_BY_COL 1  /* Walk the tiles column by column */
+#define TUNE_WALK_COLS    2  /* Inside a tile, walk the columns of A */
+
+/* Most elements of a group held in registers by trans_param() */
+#define TUNE_MAX_DEPTH    8
 
 typedef struct trans_func{
   void (*func_ptr)(int M,int N,int[N][M],int[M][N]);
@@ -16,6 +28,42 @@ typedef struct trans_func{
   unsigned int num_evictions;
 } trans_func_t;
 
+/*
+ * A kernel of kernels.c works on flat int matrices whose shapes it
+ * defines from M and N, A being N x M and B and C holding at least
+ * M*N and N*N ints. check recomputes the result naively and returns
+ * 1 if the kernel got it right.
+ */
+typedef void (*kernel_t)(int M, int N, int *A, int *B, int *C);
+typedef int (*kernel_check_t)(int M, int N, int *A, int *B, int *C);
+
+typedef struct kernel_func{
+  kernel_t func_ptr;
+  kernel_check_t check;
+  char* description;
+  char correct;
+  unsigned int num_hits;
+  unsigned int num_misses;
+  unsigned int num_evictions;
+  double seconds;        /* Wall-clock time of one run */
+} kernel_func_t;
+
+/* A configuration of the tunable blocked transpose trans_param() */
+typedef struct tune{
+  int M;                 /* Shape it was tuned for */
+  int N;
+  int tile_rows;         /* Rows of A in a tile */
+  int tile_cols;         /* Columns of A in a tile */
+  int order;             /* TUNE_TILES_BY_COL | TUNE_WALK_COLS */
+  int diag;              /* Store the diagonal element of a group last */
+  int depth;             /* Elements held in registers per group, 1 to
+                            TUNE_MAX_DEPTH */
+  int s;                 /* Cache it was tuned for */
+  int E;
+  int b;
+  unsigned int misses;   /* Misses it had on that cache */
+} tune_t;
+
 /* 
  * printSummary - This function provides a standard way for your cache
  * simulator * to display its final hit and miss statistics
@@ -34,4 +82,49 @@ void correctTrans(int M, int N, int A[N][M], int B[M][N]);
 void registerTransFunction(
     void (*trans)(int M,int N,int[N][M],int[M][N]), char* desc);
 
+/* Add the given kernel and its checker to the kernel list */
+void registerKernelFunction(kernel_t kernel, kernel_check_t check, char* desc);
+
+/* Load the configurations saved in the file, return how many */
+int loadTuning(char *filename);
+
+/* Return the loaded configuration of the shape, or NULL */
+tune_t *findTuning(int M, int N);
+
+/* Save the configuration in the file in place of the one of the same
+   shape, return -1 if the file cannot be written */
+int saveTuning(char *filename, tune_t *cfg);
+
+/*
+ * In-process tracing. A transpose function reads A and B through
+ * LOAD() and writes them through STORE(). Normally these are plain
+ * accesses; when trans.c is compiled with -DTRACE_TRANS every access
+ * is also reported to the hook set by setTraceHook(), so that a
+ * cache model can count misses without valgrind.
+ */
+typedef void (*trace_hook_t)(void *addr, int size, char op);
+
+/* Set the hook which receives the traced accesses, NULL to stop */
+void setTraceHook(trace_hook_t hook);
+
+/* The hook itself. The macros test it inline, so that the traced build
+   runs at near native speed while no hook is set */
+extern trace_hook_t trace_hook;
+
+#ifdef TRACE_TRANS
+#define TRACED(p, n, op) (trace_hook != NULL ? trace_hook((void *)(p), n, op) : (void)0)
+#define LOAD(x)         (TRACED(&(x), sizeof(x), 'L'), (x))
+/* v is evaluated before the store is reported, so that the loads it
+   makes come first in the trace, as they do under valgrind */
+#define STORE(x, v)     ({ __typeof__(x) _v = (v); \
+                           TRACED(&(x), sizeof(x), 'S'); (x) = _v; })
+#define LOAD_PTR(p)     (TRACED(p, sizeof(*(p)), 'L'), (p))
+#define STORE_PTR(p)    (TRACED(p, sizeof(*(p)), 'S'), (p))
+#else
+#define LOAD(x)         (x)
+#define STORE(x, v)     ((x) = (v))
+#define LOAD_PTR(p)     (p)
+#define STORE_PTR(p)    (p)
+#endif
+
 #endif /* CACHELAB_TOOLS_H */
@@ -0,0 +1,194 @@
+/*
+ * cachesim.c - The cache model of csim
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "cachesim.h"
+
+/* Return the address at format of address_t */
+address_t get_addr(unsigned long addr, Cache_t *cache_sim){
+ 	address_t res;
+	int i = 0;
+
+	/* Get the bit mask, a cache with s = 0 has an empty set mask */
+	unsigned long set_mask = 0;
+	unsigned long tag_mask = 0;
+
+	for (i = 0; i < cache_sim->set_bits; i++)
+		set_mask = (set_mask << 1) | 1;
+
+	for (i = 0; i < cache_sim->tag_bits; i++)
+		tag_mask = (tag_mask << 1) | 1;
+
+ 	res.set_addr = (addr >> cache_sim->block_bits) & set_mask;
+ 	res.tag = (addr >> (cache_sim->block_bits + cache_sim->set_bits)) & tag_mask;
+
+ 	return res;
+}
+
+/* Initialize the cache */
+void cache_init(Cache_t *cache_sim, int s, int e, int b){
+	cache_sim->set_bits = s;
+	cache_sim->tag_bits = BIT_OF_ADDRSS - s - b;
+	cache_sim->block_bits = b;
+
+	cache_sim->set_num = 1 << s;
+	cache_sim->line_num = e;
+	cache_sim->block_num = 1 << b;
+
+
+	cache_sim->sets = (Set_t *)malloc(sizeof(Set_t) * cache_sim->set_num);
+
+	int i = 0;
+
+	for (i = 0; i < cache_sim->set_num; i++)
+		cache_sim->sets[i] = (Line_t *)malloc(sizeof(Line_t) * cache_sim->line_num);
+
+	cache_reset(cache_sim);
+}
+
+/* Empty every line of the cache and clear the counters */
+void cache_reset(Cache_t *cache_sim) {
+	cache_sim->hits = 0;
+	cache_sim->misses = 0;
+	cache_sim->evictions = 0;
+
+	cache_sim->invalidations = 0;
+	cache_sim->coherence_misses = 0;
+	cache_sim->false_sharing = 0;
+	cache_sim->writebacks = 0;
+
+	cache_sim->compulsory = 0;
+	cache_sim->capacity = 0;
+	cache_sim->conflict = 0;
+
+	int i, j = 0;
+
+	/* Initialize every set */
+	for (i = 0; i < cache_sim->set_num; i++) {
+		/* Initialize every line of a set */
+		for (j = 0; j < cache_sim->line_num; j++) {
+			cache_sim->sets[i][j].lru = -1;
+			cache_sim->sets[i][j].valid = 0;
+			cache_sim->sets[i][j].tag = 0;
+			cache_sim->sets[i][j].state = STATE_I;
+			cache_sim->sets[i][j].invalidated = 0;
+			cache_sim->sets[i][j].inval_mask = 0;
+			cache_sim->sets[i][j].prefetched = 0;
+			cache_sim->sets[i][j].ready_at = 0;
+		}
+	}
+}
+
+/* Free the sets of the cache */
+void cache_free(Cache_t *cache_sim) {
+	int i = 0;
+
+	for (i = 0; i < cache_sim->set_num; i++)
+		free(cache_sim->sets[i]);
+	free(cache_sim->sets);
+	cache_sim->sets = NULL;
+}
+
+/* Find the line which has the largest lru */
+int find_line(Set_t set, Cache_t *cache_sim) {
+	int lru = 0;
+	int index = 0; /* The index of line which has the largest lru */
+	int i = 0;
+
+	for (i = 0; i < cache_sim->line_num; i++) {
+		if (set[i].lru > lru) {
+			lru = set[i].lru;
+			index = i;
+		}
+	}
+	return index;
+}
+
+/* Find the line to place a new block, an empty line if there is
+ * one, otherwise the line which has the largest lru
+ */
+int victim_line(Set_t set, Cache_t *cache_sim) {
+	int i = 0;
+
+	for (i = 0; i < cache_sim->line_num; i++) {
+		if (set[i].valid == 0)
+			return i;
+	}
+	return find_line(set, cache_sim);
+}
+
+/* Update the lru of a line after having access to it 
+ * The index represent the index of line which user have
+ * just visited
+ */
+void update_lru(Line_t *lines, int index, Cache_t *cache_sim) {
+	lines[index].lru = 0;
+	int i = 0;
+	for (i = 0; i < cache_sim->line_num; i++) {
+		if (i != index && lines[i].valid == 1)
+			lines[i].lru++;
+	}
+}
+
+/* Beacause the operation of load and store have the same effect,
+ * so it can be merged to one funcion
+ */
+void load_store(address_t addr, Cache_t *cache_sim, int verbose) {
+	Set_t set = cache_sim->sets[addr.set_addr];
+	unsigned long tag = addr.tag;
+	int i = 0;
+	/* Find the line which has corresponding tag */
+	for (i = 0; i < cache_sim->line_num; i++) {
+		if (set[i].valid == 1 && set[i].tag == tag) {
+			update_lru(set, i, cache_sim);
+			cache_sim->hits++;
+			
+			if (verbose == 1) 
+				printf("hit ");
+
+			return;
+		}
+	}
+	
+	/* If none of line has the corresponding tag, the status is miss */
+	cache_sim->misses++;
+
+	if (verbose == 1)
+		printf("miss ");
+
+	/* Use an empty line, or evict the line which has largest lru */
+	int index = victim_line(set, cache_sim);
+	if (set[index].valid == 1) {
+		cache_sim->evictions++;
+		if (verbose == 1)
+			printf("eviction ");
+	}
+	set[index].tag = tag;
+	set[index].valid = 1;
+	update_lru(set, index, cache_sim);
+
+	return;
+}
+
+
+void modify(address_t addr, Cache_t *cache_sim, int verbose) {
+	load_store(addr, cache_sim, verbose);
+	load_store(addr, cache_sim, verbose);
+}
+
+/* Return the index of the valid line holding the tag, or -1 */
+int lookup_line(Set_t set, unsigned long tag, Cache_t *cache_sim) {
+	int i = 0;
+
+	for (i = 0; i < cache_sim->line_num; i++) {
+		if (set[i].valid == 1 && set[i].tag == tag)
+			return i;
+	}
+	return -1;
+}
+
+/* Load or store one address, for the users of the library */
+void cache_access(Cache_t *cache_sim, unsigned long addr) {
+	load_store(get_addr(addr, cache_sim), cache_sim, 0);
+}
@@ -0,0 +1,93 @@
+/*
+ * cachesim.h - The cache model of csim, a set associative cache with
+ *     LRU replacement. It is also linked into the tools which evaluate
+ *     transpose functions in process.
+ */
+#ifndef CACHESIM_H
+#define CACHESIM_H
+
+#define BIT_OF_ADDRSS	64
+
+/* Coherence states of a line, only used in the multi-core mode */
+#define STATE_I			0	/* Invalid */
+#define STATE_S			1	/* Shared */
+#define STATE_E			2	/* Exclusive */
+#define STATE_O			3	/* Owned, MOESI only */
+#define STATE_M			4	/* Modified */
+
+/* Define the a line of a set */
+typedef struct {
+	int lru;
+	int valid;
+	unsigned long tag;
+	int state;					/* Coherence state */
+	int invalidated;			/* Invalidated by another core, tag is kept */
+	unsigned long inval_mask;	/* Bytes written by the invalidating core */
+	int prefetched;				/* Filled by a prefetch and not used yet */
+	long ready_at;				/* Clock when the prefetched data arrives */
+} Line_t;
+
+/* Define the struct of the set */
+typedef Line_t *Set_t;
+
+/* Define the struct of the cache */
+typedef struct {
+	int set_bits;
+	int tag_bits;
+	int block_bits;
+
+	int set_num;
+	int line_num;
+	int block_num;
+
+	int hits;
+	int misses;
+	int evictions;
+
+	/* Statistics of the multi-core mode */
+	int invalidations;
+	int coherence_misses;
+	int false_sharing;
+	int writebacks;
+
+	/* Kinds of the misses, only counted with -3 */
+	int compulsory;
+	int capacity;
+	int conflict;
+
+	Set_t *sets;
+} Cache_t;
+
+/* Define the struct of the address */
+typedef struct {
+	unsigned long tag;
+	int set_addr;
+} address_t;
+
+/* Return the address at format of address_t */
+address_t get_addr(unsigned long addr, Cache_t *cache_sim);
+
+/* Initialize the cache with 2^s sets of e lines of 2^b bytes */
+void cache_init(Cache_t *cache_sim, int s, int e, int b);
+
+/* Empty every line and clear the counters */
+void cache_reset(Cache_t *cache_sim);
+
+/* Free the sets of the cache */
+void cache_free(Cache_t *cache_sim);
+
+int find_line(Set_t set, Cache_t *cache_sim);
+int victim_line(Set_t set, Cache_t *cache_sim);
+int lookup_line(Set_t set, unsigned long tag, Cache_t *cache_sim);
+void update_lru(Line_t *lines, int index, Cache_t *cache_sim);
+
+/* Load or store one address, print the outcome if verbose is 1 */
+void load_store(address_t addr, Cache_t *cache_sim, int verbose);
+
+/* Modify one address, a load followed by a store */
+void modify(address_t addr, Cache_t *cache_sim, int verbose);
+
+/* Load or store one address, for the users of the library */
+void cache_access(Cache_t *cache_sim, unsigned long addr);
+
+#endif /* CACHESIM_H */
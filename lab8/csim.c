@@ -1,4 +1,5 @@
 #include "cachelab.h"
+#include "cachesim.h"
 
 #include <getopt.h> 
 #include <stdlib.h> 
@@ -6,197 +7,1238 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
-#define BIT_OF_ADDRSS	64
+#define MAX_THREADS		64
+#define MAX_CORES		64
+#define MAXLINE			1024
+#define TOP_LINES		10
 
-/* Define the a line of a set */
+#define CHUNK_ACCESSES	4096	/* Accesses handed to a worker at once */
+#define CHUNK_QUEUE		4		/* Chunks a worker may have waiting */
+
+#define PROTOCOL_MESI	0
+#define PROTOCOL_MOESI	1
+
+/* Kinds of the hardware prefetcher */
+#define PREFETCH_NONE	0
+#define PREFETCH_NEXT	1	/* Next-line, tagged */
+#define PREFETCH_STRIDE	2	/* Stride table per pc, or per page without pc */
+#define PREFETCH_STREAM	3	/* Stream buffers of sequential blocks */
+
+#define STREAM_NUM		16	/* Number of streams tracked */
+#define STREAM_WINDOW	16	/* Blocks within which a miss joins a stream */
+#define PAGE_BITS		12
+
+/* Define a decoded access of the trace */
 typedef struct {
-	int lru;
-	int valid;
-	unsigned int tag;
-} Line_t;
+	char op;
+	address_t addr;
+} access_t;
 
-/* Define the struct of the set */
-typedef Line_t *Set_t;
+/* Define a chunk of decoded accesses handed to a worker */
+typedef struct {
+	access_t *accesses;
+	int count;
+} chunk_t;
 
-/* Define the struct of the cache */
+/* Define the work of one thread in the parallel mode. Every worker
+ * owns a contiguous slice of the sets, so it can share the sets
+ * with the others and only keep its own counters. It gets its
+ * accesses in chunks through a bounded queue, as they are decoded.
+ */
 typedef struct {
-	int set_bits;
-	int tag_bits;
-	int block_bits;
+	Cache_t cache;
+	chunk_t filling;			/* Chunk the decoder is filling */
+	chunk_t queue[CHUNK_QUEUE];	/* Ring of the chunks waiting */
+	int head;					/* Next chunk to replay */
+	int waiting;				/* Chunks in the ring */
+	int done;					/* No more chunks will come */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* The ring changed, or done was set */
+	pthread_t tid;
+} worker_t;
 
-	int set_num;
-	int line_num;
-	int block_num;
+/* Define a node of the hash table, keyed by an address */
+typedef struct hash_node {
+	unsigned long key;
+	void *val;
+	struct hash_node *next;
+} hash_node_t;
 
+/* Define a chained hash table */
+typedef struct {
+	hash_node_t **buckets;
+	int bucket_num;
+	int size;
+} hash_t;
+
+/* Define the coherence statistics of one line in the multi-core mode */
+typedef struct {
+	unsigned long block;
+	int invalidations;
+	int coherence_misses;
+	int false_sharing;
+} line_stat_t;
+
+/* Define the machine of the multi-core mode */
+typedef struct {
+	int core_num;
+	int protocol;
+	Cache_t *cores;			/* Private cache of every core */
+	hash_t line_stats;		/* Block address -> line_stat_t */
+} Multicore_t;
+
+/* Define the statistics attributed to an address range, an
+ * instruction or a marker bracket
+ */
+typedef struct {
+	unsigned long key;
 	int hits;
 	int misses;
 	int evictions;
+	int compulsory;
+	int capacity;
+	int conflict;
+} attr_stat_t;
 
-	Set_t *sets;
-} Cache_t;
+/* Define a symbol of the symbol map */
+typedef struct {
+	unsigned long start;
+	unsigned long size;
+	char *name;
+} symbol_t;
 
-/* Define the struct of the address */
+/* Define the attribution report */
 typedef struct {
-	unsigned int tag;
-	int set_addr;
-} address_t;
-
-address_t get_addr(int addr, Cache_t *cache_sim);
-void cache_init(Cache_t *cache_sim, int S, int E, int B);
-int find_line(Set_t set, Cache_t *cache_sim);
-void update_lru(Line_t *lines, int index, Cache_t *cache_sim);
+	int region_bits;		/* An address range has 2^region_bits bytes */
+	hash_t regions;			/* Address >> region_bits -> attr_stat_t */
+	hash_t pcs;				/* Instruction address -> attr_stat_t */
+	hash_t brackets;		/* Index of marker bracket -> attr_stat_t */
+
+	symbol_t *symbols;		/* Sorted by start address */
+	int symbol_num;
+
+	int has_marker;
+	unsigned long marker_start;
+	unsigned long marker_end;
+	int bracket;			/* Current marker bracket, -1 if outside */
+	int bracket_num;
+
+	unsigned long pc;		/* Address of the last instruction */
+	int classify;			/* Print the kinds of the misses */
+} Report_t;
+
+/* Define an entry of the stride table */
+typedef struct {
+	unsigned long last;		/* Last address accessed */
+	long stride;
+	int confidence;
+} stride_entry_t;
+
+/* Define a stream of sequential blocks */
+typedef struct {
+	int valid;
+	unsigned long last;		/* Last block of the stream */
+	int dir;				/* 1 ascending, -1 descending, 0 unknown */
+	int confidence;
+	long used;				/* Clock of the last use, for replacement */
+} stream_t;
+
+/* Define the hardware prefetcher */
+typedef struct {
+	int kind;
+	int degree;				/* Blocks prefetched per trigger */
+	int latency;			/* Demand accesses before a prefetch arrives */
+	long clock;				/* Number of demand accesses so far */
+
+	hash_t strides;			/* pc or page -> stride_entry_t */
+	stream_t streams[STREAM_NUM];
+	hash_t polluted;		/* Block evicted by a prefetch -> int flag */
+
+	int issued;
+	int useful;				/* Used by a demand access after it arrives */
+	int late;				/* Used by a demand access before it arrives */
+	int useless;			/* Evicted before any use */
+	int polluting;			/* Demand misses on blocks a prefetch evicted */
+	int evictions;			/* Lines evicted by prefetch fills, not counted
+							   in the evictions of the cache */
+} Prefetcher_t;
+
+/* Define a block of the fully associative shadow cache */
+typedef struct shadow_node {
+	unsigned long block;
+	struct shadow_node *prev;
+	struct shadow_node *next;
+} shadow_node_t;
+
+/* Define the classifier of the misses. A miss is compulsory on the
+ * first touch of the block, a capacity miss if a fully associative
+ * LRU cache of the same size misses too, and a conflict miss else
+ */
+typedef struct {
+	hash_t seen;			/* Blocks touched so far */
+	hash_t shadow_map;		/* Block -> shadow_node_t */
+	shadow_node_t head;		/* head.next is the most recently used */
+	int capacity;			/* Lines of the shadow cache */
+} Classifier_t;
+
+void run_sequential(FILE *file, Cache_t *cache_sim, int verbose, Report_t *report,
+		Prefetcher_t *pf, Classifier_t *cls);
+void run_parallel(FILE *file, Cache_t *cache_sim, int nthreads);
+void hash_init(hash_t *hash, int bucket_num);
+void *hash_find(hash_t *hash, unsigned long key);
+void hash_insert(hash_t *hash, unsigned long key, void *val);
+void *hash_remove(hash_t *hash, unsigned long key);
+hash_node_t **hash_nodes(hash_t *hash);
+void run_multicore(FILE *file, Multicore_t *mc, int verbose);
+void report_instruction(Report_t *report, unsigned long addr);
+void report_access(Report_t *report, unsigned long addr, Cache_t *before,
+		Cache_t *after);
+void prefetch_access(Prefetcher_t *pf, Cache_t *cache_sim, unsigned long addr,
+		unsigned long pc, int verbose);
+void classify_access(Classifier_t *cls, unsigned long addr, Cache_t *before,
+		Cache_t *cache_sim, int verbose);
 void print_help_menu();
 
-/* Return the address at format of address_t */
-address_t get_addr(int addr, Cache_t *cache_sim){
- 	address_t res;
+/* Replay the trace in order on one thread */
+void run_sequential(FILE *file, Cache_t *cache_sim, int verbose, Report_t *report,
+		Prefetcher_t *pf, Classifier_t *cls) {
+	unsigned long addr, pc = 0;
+	int block_size = 0;
+	char opt[2];
+	address_t addr_s;
+	Cache_t before;
+
+	while (fscanf(file, "%s %lx,%d", opt, &addr, &block_size) != EOF) {
+		if (verbose == 1)
+			printf("%s %lx,%d ", opt, addr, block_size);
+
+		if (opt[0] == 'I') {
+			pc = addr;
+			if (report != NULL)
+				report_instruction(report, addr);
+			if (verbose == 1)
+				printf("\n");
+			continue;
+		}
+
+		addr_s = get_addr(addr, cache_sim);
+		before = *cache_sim;
+
+		if (pf != NULL) {
+			if (opt[0] == 'M' || opt[0] == 'L' || opt[0] == 'S')
+				prefetch_access(pf, cache_sim, addr, pc, verbose);
+			if (opt[0] == 'M')
+				prefetch_access(pf, cache_sim, addr, pc, verbose);
+		}
+		else {
+			if (opt[0] == 'M')
+				modify(addr_s, cache_sim, verbose);
+
+			if (opt[0] == 'L')
+				load_store(addr_s, cache_sim, verbose);
+
+			if (opt[0] == 'S')
+				load_store(addr_s, cache_sim, verbose);
+		}
+
+		if (cls != NULL)
+			classify_access(cls, addr, &before, cache_sim, verbose);
+
+		if (report != NULL)
+			report_access(report, addr, &before, cache_sim);
+
+		if (verbose == 1)
+			printf("\n");
+	}
+}
+
+/* Thread routine of the parallel mode, replay the accesses of its
+ * own sets in the order they appear in the trace, a chunk at a time
+ */
+void *worker_thread(void *vargp) {
+	worker_t *worker = (worker_t *)vargp;
+	chunk_t chunk;
+	int i = 0;
+
+	while (1) {
+		pthread_mutex_lock(&worker->lock);
+		while (worker->waiting == 0 && !worker->done)
+			pthread_cond_wait(&worker->cond, &worker->lock);
+		if (worker->waiting == 0) {
+			pthread_mutex_unlock(&worker->lock);
+			return NULL;
+		}
+		chunk = worker->queue[worker->head];
+		worker->head = (worker->head + 1) % CHUNK_QUEUE;
+		worker->waiting--;
+		pthread_cond_signal(&worker->cond);
+		pthread_mutex_unlock(&worker->lock);
+
+		for (i = 0; i < chunk.count; i++) {
+			if (chunk.accesses[i].op == 'M')
+				modify(chunk.accesses[i].addr, &worker->cache, 0);
+			else
+				load_store(chunk.accesses[i].addr, &worker->cache, 0);
+		}
+		free(chunk.accesses);
+	}
+}
+
+/* Hand the chunk the worker is filling to it, waiting while its ring
+ * is full, and start a new one unless it is the last
+ */
+void hand_chunk(worker_t *worker, int last) {
+	pthread_mutex_lock(&worker->lock);
+	while (worker->waiting == CHUNK_QUEUE)
+		pthread_cond_wait(&worker->cond, &worker->lock);
+	worker->queue[(worker->head + worker->waiting) % CHUNK_QUEUE] =
+		worker->filling;
+	worker->waiting++;
+	worker->done = last;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+
+	if (last)
+		return;
+	worker->filling.accesses = (access_t *)malloc(sizeof(access_t) *
+			CHUNK_ACCESSES);
+	worker->filling.count = 0;
+}
+
+/* Replay the trace on nthreads threads. Accesses to different sets
+ * never affect each other, so the trace is partitioned by set_addr
+ * and every thread simulates its own slice of the sets. The trace is
+ * decoded while the workers replay it: every CHUNK_ACCESSES accesses
+ * of a worker are handed to it, and the decoder waits when a worker
+ * has CHUNK_QUEUE chunks waiting, so the memory does not grow with
+ * the trace. The counters are merged at the end, so the result is the
+ * same as the one of run_sequential.
+ */
+void run_parallel(FILE *file, Cache_t *cache_sim, int nthreads) {
+	unsigned long addr;
+	int block_size = 0;
+	char opt[2];
+	address_t addr_s;
+	worker_t *workers;
+	worker_t *worker;
+	int sets_per_worker;
 	int i = 0;
 
-	/* Get the bit mask */
-	unsigned int set_mask = 1;
-	unsigned int tag_mask = 1;
+	if (nthreads > cache_sim->set_num)
+		nthreads = cache_sim->set_num;
+	sets_per_worker = (cache_sim->set_num + nthreads - 1) / nthreads;
+
+	workers = (worker_t *)calloc(nthreads, sizeof(worker_t));
+	for (i = 0; i < nthreads; i++) {
+		workers[i].cache = *cache_sim;
+		workers[i].filling.accesses = (access_t *)malloc(sizeof(access_t) *
+				CHUNK_ACCESSES);
+		pthread_mutex_init(&workers[i].lock, NULL);
+		pthread_cond_init(&workers[i].cond, NULL);
+		pthread_create(&workers[i].tid, NULL, worker_thread, &workers[i]);
+	}
 
-	for (i = 0; i < cache_sim->set_bits - 1; i++)
-		set_mask |= (set_mask << 1);
+	/* Decode the trace and hand every access to the owner of its set */
+	while (fscanf(file, "%s %lx,%d", opt, &addr, &block_size) != EOF) {
+		if (opt[0] != 'L' && opt[0] != 'S' && opt[0] != 'M')
+			continue;
 
-	for (i = 0; i < cache_sim->tag_bits - 1; i++)
-		tag_mask |= (tag_mask << 1);
+		addr_s = get_addr(addr, cache_sim);
+		worker = &workers[addr_s.set_addr / sets_per_worker];
+		worker->filling.accesses[worker->filling.count].op = opt[0];
+		worker->filling.accesses[worker->filling.count].addr = addr_s;
+		if (++worker->filling.count == CHUNK_ACCESSES)
+			hand_chunk(worker, 0);
+	}
 
- 	res.set_addr = (addr >> cache_sim->block_bits) & set_mask;
- 	res.tag = (addr >> (cache_sim->block_bits + cache_sim->set_bits)) & tag_mask;
+	/* Hand the last chunks, then merge the counters of every worker */
+	for (i = 0; i < nthreads; i++)
+		hand_chunk(&workers[i], 1);
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].tid, NULL);
+		cache_sim->hits += workers[i].cache.hits;
+		cache_sim->misses += workers[i].cache.misses;
+		cache_sim->evictions += workers[i].cache.evictions;
+		pthread_mutex_destroy(&workers[i].lock);
+		pthread_cond_destroy(&workers[i].cond);
+	}
+	free(workers);
+}
 
- 	return res;
+/* Initialize an empty hash table */
+void hash_init(hash_t *hash, int bucket_num) {
+	hash->buckets = (hash_node_t **)calloc(bucket_num, sizeof(hash_node_t *));
+	hash->bucket_num = bucket_num;
+	hash->size = 0;
 }
 
-/* Initialize the cache */
-void cache_init(Cache_t *cache_sim, int s, int e, int b){
-	cache_sim->hits = 0;
-	cache_sim->misses = 0;
-	cache_sim->evictions = 0;
+/* Return the value of the key, or NULL if the key is absent */
+void *hash_find(hash_t *hash, unsigned long key) {
+	hash_node_t *node = hash->buckets[key % hash->bucket_num];
 
-	cache_sim->set_bits = s;
-	cache_sim->tag_bits = BIT_OF_ADDRSS - s - b;
-	cache_sim->block_bits = b;
+	for (; node != NULL; node = node->next) {
+		if (node->key == key)
+			return node->val;
+	}
+	return NULL;
+}
 
-	cache_sim->set_num = 1 << s;
-	cache_sim->line_num = e;
-	cache_sim->block_num = 1 << b;
+/* Insert a key which is not in the table yet. The table doubles
+ * its buckets when it holds twice as many keys as buckets
+ */
+void hash_insert(hash_t *hash, unsigned long key, void *val) {
+	hash_node_t *node;
+	int i = 0;
 
+	if (hash->size >= hash->bucket_num * 2) {
+		hash_t bigger;
+		hash_node_t *next;
 
-	cache_sim->sets = (Set_t *)malloc(sizeof(Set_t) * cache_sim->set_num);
+		hash_init(&bigger, hash->bucket_num * 2);
+		for (i = 0; i < hash->bucket_num; i++) {
+			for (node = hash->buckets[i]; node != NULL; node = next) {
+				next = node->next;
+				node->next = bigger.buckets[node->key % bigger.bucket_num];
+				bigger.buckets[node->key % bigger.bucket_num] = node;
+			}
+		}
+		free(hash->buckets);
+		hash->buckets = bigger.buckets;
+		hash->bucket_num = bigger.bucket_num;
+	}
+
+	node = (hash_node_t *)malloc(sizeof(hash_node_t));
+	node->key = key;
+	node->val = val;
+	node->next = hash->buckets[key % hash->bucket_num];
+	hash->buckets[key % hash->bucket_num] = node;
+	hash->size++;
+}
 
-	int i, j = 0;
+/* Remove the key from the table, return its value or NULL */
+void *hash_remove(hash_t *hash, unsigned long key) {
+	hash_node_t **link = &hash->buckets[key % hash->bucket_num];
+	hash_node_t *node;
+	void *val;
 
-	/* Initialize every set */
-	for (i = 0; i < cache_sim->set_num; i++) {
-		cache_sim->sets[i] = (Line_t *)malloc(sizeof(Line_t) * cache_sim->line_num);
-		/* Initialize every line of a set */
-		for (j = 0; j < cache_sim->line_num; j++) {
-			cache_sim->sets[i][j].lru = -1;
-			cache_sim->sets[i][j].valid = 0;
-			cache_sim->sets[i][j].tag = 0;
+	for (; *link != NULL; link = &(*link)->next) {
+		if ((*link)->key == key) {
+			node = *link;
+			val = node->val;
+			*link = node->next;
+			free(node);
+			hash->size--;
+			return val;
 		}
 	}
+	return NULL;
 }
 
-/* Find the line which has the largest lru */
-int find_line(Set_t set, Cache_t *cache_sim) {
-	int lru = 0;
-	int index = 0; /* The index of line which has the largest lru */
+/* Return an array of all the nodes of the table, the caller frees it */
+hash_node_t **hash_nodes(hash_t *hash) {
+	hash_node_t **nodes;
+	hash_node_t *node;
+	int i = 0, n = 0;
+
+	nodes = (hash_node_t **)malloc(sizeof(hash_node_t *) * (hash->size + 1));
+	for (i = 0; i < hash->bucket_num; i++) {
+		for (node = hash->buckets[i]; node != NULL; node = node->next)
+			nodes[n++] = node;
+	}
+	return nodes;
+}
+
+/* Return the mask of the bytes [addr, addr + size) inside their
+ * block. A bit stands for one byte, or for block_num / 64 bytes
+ * when the block is larger than 64 bytes
+ */
+unsigned long byte_mask(unsigned long addr, int size, Cache_t *cache_sim) {
+	int unit = cache_sim->block_num > 64 ? cache_sim->block_num / 64 : 1;
+	int bits = cache_sim->block_num / unit;
+	int offset = addr & (cache_sim->block_num - 1);
+	int first = offset / unit;
+	int last = (offset + (size > 0 ? size : 1) - 1) / unit;
+	unsigned long mask = 0;
 	int i = 0;
 
+	if (last >= bits)
+		last = bits - 1;
+	for (i = first; i <= last; i++)
+		mask |= 1UL << i;
+	return mask;
+}
+
+/* Return the statistics of the block, create it if necessary */
+line_stat_t *line_stat(Multicore_t *mc, unsigned long block) {
+	line_stat_t *stat = (line_stat_t *)hash_find(&mc->line_stats, block);
+
+	if (stat == NULL) {
+		stat = (line_stat_t *)calloc(1, sizeof(line_stat_t));
+		stat->block = block;
+		hash_insert(&mc->line_stats, block, stat);
+	}
+	return stat;
+}
+
+/* Invalidate the copies of the block in every core except the
+ * requester, remember which bytes the requester writes so that a
+ * later miss on the copy can be classified. Return the number of
+ * copies invalidated
+ */
+int invalidate_others(Multicore_t *mc, int core, address_t addr,
+		unsigned long block, unsigned long mask) {
+	int i = 0, index = 0, count = 0;
+	Set_t set;
+
+	for (i = 0; i < mc->core_num; i++) {
+		if (i == core)
+			continue;
+		set = mc->cores[i].sets[addr.set_addr];
+		if ((index = lookup_line(set, addr.tag, &mc->cores[i])) == -1)
+			continue;
+		/* A dirty copy goes to the requester, it is not written back */
+		set[index].valid = 0;
+		set[index].state = STATE_I;
+		set[index].invalidated = 1;
+		set[index].inval_mask = mask;
+		mc->cores[i].invalidations++;
+		count++;
+	}
+	if (count > 0)
+		line_stat(mc, block)->invalidations += count;
+	return count;
+}
+
+/* Snoop a read miss of the requester on the bus. The other copies
+ * are downgraded, a Modified copy is written back under MESI and
+ * becomes Owned under MOESI. Return whether another core has a copy
+ */
+int snoop_read(Multicore_t *mc, int core, address_t addr) {
+	int i = 0, index = 0, shared = 0;
+	Set_t set;
+
+	for (i = 0; i < mc->core_num; i++) {
+		if (i == core)
+			continue;
+		set = mc->cores[i].sets[addr.set_addr];
+		if ((index = lookup_line(set, addr.tag, &mc->cores[i])) == -1)
+			continue;
+		shared = 1;
+		if (set[index].state == STATE_M) {
+			if (mc->protocol == PROTOCOL_MOESI) {
+				set[index].state = STATE_O;
+			}
+			else {
+				set[index].state = STATE_S;
+				mc->cores[i].writebacks++;
+			}
+		}
+		else if (set[index].state == STATE_E) {
+			set[index].state = STATE_S;
+		}
+	}
+	return shared;
+}
+
+/* Access one block from one core under the coherence protocol. A
+ * miss on a line another core has invalidated is a coherence miss,
+ * and it is a false sharing miss if the bytes accessed now are not
+ * the bytes which the other core wrote
+ */
+void coherent_access(Multicore_t *mc, int core, unsigned long addr, int size,
+		int write, int verbose) {
+	Cache_t *cache_sim = &mc->cores[core];
+	address_t addr_s = get_addr(addr, cache_sim);
+	Set_t set = cache_sim->sets[addr_s.set_addr];
+	unsigned long block = addr >> cache_sim->block_bits;
+	unsigned long mask = byte_mask(addr, size, cache_sim);
+	int index = 0, i = 0;
+
+	if ((index = lookup_line(set, addr_s.tag, cache_sim)) != -1) {
+		cache_sim->hits++;
+		if (verbose == 1)
+			printf("hit ");
+
+		if (write) {
+			/* Shared and Owned lines must upgrade on the bus */
+			if (set[index].state == STATE_S || set[index].state == STATE_O) {
+				if (verbose == 1)
+					printf("upgrade ");
+				invalidate_others(mc, core, addr_s, block, mask);
+			}
+			set[index].state = STATE_M;
+		}
+		update_lru(set, index, cache_sim);
+		return;
+	}
+
+	cache_sim->misses++;
+	if (verbose == 1)
+		printf("miss ");
+
+	/* Check whether the block was taken away by another core */
 	for (i = 0; i < cache_sim->line_num; i++) {
-		if (set[i].lru > lru) {
-			lru = set[i].lru;
-			index = i;
+		if (set[i].valid == 0 && set[i].invalidated == 1 &&
+				set[i].tag == addr_s.tag) {
+			line_stat_t *stat = line_stat(mc, block);
+
+			set[i].invalidated = 0;
+			cache_sim->coherence_misses++;
+			stat->coherence_misses++;
+			if ((set[i].inval_mask & mask) == 0) {
+				cache_sim->false_sharing++;
+				stat->false_sharing++;
+				if (verbose == 1)
+					printf("false-sharing ");
+			}
+			else if (verbose == 1) {
+				printf("coherence ");
+			}
+			break;
+		}
+	}
+
+	index = victim_line(set, cache_sim);
+	if (set[index].valid == 1) {
+		cache_sim->evictions++;
+		if (set[index].state == STATE_M || set[index].state == STATE_O)
+			cache_sim->writebacks++;
+		if (verbose == 1)
+			printf("eviction ");
+	}
+
+	if (write) {
+		invalidate_others(mc, core, addr_s, block, mask);
+		set[index].state = STATE_M;
+	}
+	else {
+		set[index].state = snoop_read(mc, core, addr_s) ? STATE_S : STATE_E;
+	}
+	set[index].tag = addr_s.tag;
+	set[index].valid = 1;
+	set[index].invalidated = 0;
+	update_lru(set, index, cache_sim);
+}
+
+/* Order the lines by false sharing misses, then coherence misses */
+int compare_line_stat(const void *a, const void *b) {
+	line_stat_t *x = (line_stat_t *)(*(hash_node_t **)a)->val;
+	line_stat_t *y = (line_stat_t *)(*(hash_node_t **)b)->val;
+
+	if (x->false_sharing != y->false_sharing)
+		return y->false_sharing - x->false_sharing;
+	if (x->coherence_misses != y->coherence_misses)
+		return y->coherence_misses - x->coherence_misses;
+	return y->invalidations - x->invalidations;
+}
+
+/* Replay a trace whose accesses are tagged with a core id, like
+ * " S 7ff000398,8 2". An access without the id comes from core 0
+ */
+void run_multicore(FILE *file, Multicore_t *mc, int verbose) {
+	char buf[MAXLINE];
+	char op;
+	unsigned long addr;
+	int size = 0, core = 0, n = 0;
+
+	while (fgets(buf, MAXLINE, file) != NULL) {
+		core = 0;
+		n = sscanf(buf, " %c %lx,%d %d", &op, &addr, &size, &core);
+		if (n < 3 || (op != 'L' && op != 'S' && op != 'M'))
+			continue;
+		if (core < 0 || core >= mc->core_num) {
+			fprintf(stderr, "Ignore the access of unknown core %d\n", core);
+			continue;
 		}
+
+		if (verbose == 1)
+			printf("%c %lx,%d %d ", op, addr, size, core);
+
+		if (op == 'M') {
+			coherent_access(mc, core, addr, size, 0, verbose);
+			coherent_access(mc, core, addr, size, 1, verbose);
+		}
+		else {
+			coherent_access(mc, core, addr, size, op == 'S', verbose);
+		}
+
+		if (verbose == 1)
+			printf("\n");
 	}
-	return index;
 }
 
-/* Update the lru of a line after having access to it 
- * The index represent the index of line which user have
- * just visited
+/* Print the statistics of every core and the lines which suffer
+ * from false sharing most
  */
-void update_lru(Line_t *lines, int index, Cache_t *cache_sim) {
-	lines[index].lru = 0;
+void print_multicore(Multicore_t *mc) {
+	hash_node_t **nodes = hash_nodes(&mc->line_stats);
+	line_stat_t *stat;
+	Cache_t *cache_sim;
+	int invalidations = 0, coherence_misses = 0;
+	int false_sharing = 0, writebacks = 0;
 	int i = 0;
-	for (i = 0; i < cache_sim->line_num; i++) {
-		if (i != index && lines[i].valid == 1)
-			lines[i].lru++;
+
+	for (i = 0; i < mc->core_num; i++) {
+		cache_sim = &mc->cores[i];
+		printf("core %d: hits:%d misses:%d evictions:%d invalidations:%d "
+				"coherence-misses:%d false-sharing:%d writebacks:%d\n",
+				i, cache_sim->hits, cache_sim->misses, cache_sim->evictions,
+				cache_sim->invalidations, cache_sim->coherence_misses,
+				cache_sim->false_sharing, cache_sim->writebacks);
+		invalidations += cache_sim->invalidations;
+		coherence_misses += cache_sim->coherence_misses;
+		false_sharing += cache_sim->false_sharing;
+		writebacks += cache_sim->writebacks;
 	}
+	printf("%s: invalidations:%d coherence-misses:%d false-sharing:%d "
+			"writebacks:%d\n", mc->protocol == PROTOCOL_MOESI ? "MOESI" : "MESI",
+			invalidations, coherence_misses, false_sharing, writebacks);
+
+	qsort(nodes, mc->line_stats.size, sizeof(hash_node_t *), compare_line_stat);
+	for (i = 0; i < mc->line_stats.size && i < TOP_LINES; i++) {
+		stat = (line_stat_t *)nodes[i]->val;
+		if (stat->coherence_misses == 0)
+			break;
+		if (i == 0)
+			printf("Top lines by false sharing:\n");
+		printf("  %lx-%lx false-sharing:%d coherence-misses:%d "
+				"invalidations:%d\n",
+				stat->block << mc->cores[0].block_bits,
+				((stat->block + 1) << mc->cores[0].block_bits) - 1,
+				stat->false_sharing, stat->coherence_misses,
+				stat->invalidations);
+	}
+	free(nodes);
+}
+
+/* Compare two symbols by their start address */
+int compare_symbol(const void *a, const void *b) {
+	unsigned long x = ((symbol_t *)a)->start;
+	unsigned long y = ((symbol_t *)b)->start;
+
+	return x < y ? -1 : x > y;
 }
 
-/* Beacause the operation of load and store have the same effect,
- * so it can be merged to one funcion
+/* Load the symbol map from the output of "nm -S", every line of it
+ * is like "0000000000602260 0000000000040000 b A". Lines without a
+ * size are ignored. Return -1 if the file cannot be opened
  */
-void load_store(address_t addr, Cache_t *cache_sim, int verbose) {
-	Set_t set = cache_sim->sets[addr.set_addr];
-	unsigned int tag = addr.tag;
+int load_symbols(Report_t *report, char *filename) {
+	FILE *file = fopen(filename, "r");
+	char buf[MAXLINE], name[MAXLINE];
+	unsigned long start, size;
+	char type;
+	int cap = 0;
+
+	if (file == NULL)
+		return -1;
+
+	while (fgets(buf, MAXLINE, file) != NULL) {
+		if (sscanf(buf, "%lx %lx %c %s", &start, &size, &type, name) != 4)
+			continue;
+		if (report->symbol_num == cap) {
+			cap = cap ? cap * 2 : 256;
+			report->symbols = (symbol_t *)realloc(report->symbols,
+					sizeof(symbol_t) * cap);
+		}
+		report->symbols[report->symbol_num].start = start;
+		report->symbols[report->symbol_num].size = size;
+		report->symbols[report->symbol_num].name = (char *)malloc(strlen(name) + 1);
+		strcpy(report->symbols[report->symbol_num].name, name);
+		report->symbol_num++;
+	}
+	fclose(file);
+
+	qsort(report->symbols, report->symbol_num, sizeof(symbol_t), compare_symbol);
+	return 0;
+}
+
+/* Load the addresses of MARKER_START and MARKER_END which tracegen
+ * records in the file ".marker". Return -1 if it cannot be read
+ */
+int load_marker(Report_t *report, char *filename) {
+	FILE *file = fopen(filename, "r");
+	int n = 0;
+
+	if (file == NULL)
+		return -1;
+	n = fscanf(file, "%lx %lx", &report->marker_start, &report->marker_end);
+	fclose(file);
+	if (n != 2)
+		return -1;
+	report->has_marker = 1;
+	return 0;
+}
+
+/* Write "symbol+offset" of the address into buf, which has MAXLINE
+ * bytes. Return 0 if no symbol covers the address
+ */
+int symbol_name(Report_t *report, unsigned long addr, char *buf) {
+	int low = 0, high = report->symbol_num - 1, mid = 0;
+	symbol_t *sym = NULL;
+
+	/* Find the last symbol which starts at or before addr */
+	while (low <= high) {
+		mid = (low + high) / 2;
+		if (report->symbols[mid].start <= addr) {
+			sym = &report->symbols[mid];
+			low = mid + 1;
+		}
+		else {
+			high = mid - 1;
+		}
+	}
+
+	if (sym == NULL || addr >= sym->start + sym->size)
+		return 0;
+	snprintf(buf, MAXLINE, "%s+0x%lx", sym->name, addr - sym->start);
+	return 1;
+}
+
+/* Initialize an empty report */
+void report_init(Report_t *report, int region_bits) {
+	report->region_bits = region_bits;
+	hash_init(&report->regions, 1024);
+	hash_init(&report->pcs, 1024);
+	hash_init(&report->brackets, 16);
+	report->symbols = NULL;
+	report->symbol_num = 0;
+	report->has_marker = 0;
+	report->bracket = -1;
+	report->bracket_num = 0;
+	report->pc = 0;
+}
+
+/* Add the outcome of one access to the entry of the key */
+void attr_add(hash_t *hash, unsigned long key, Cache_t *before, Cache_t *after) {
+	attr_stat_t *stat = (attr_stat_t *)hash_find(hash, key);
+
+	if (stat == NULL) {
+		stat = (attr_stat_t *)calloc(1, sizeof(attr_stat_t));
+		stat->key = key;
+		hash_insert(hash, key, stat);
+	}
+	stat->hits += after->hits - before->hits;
+	stat->misses += after->misses - before->misses;
+	stat->evictions += after->evictions - before->evictions;
+	stat->compulsory += after->compulsory - before->compulsory;
+	stat->capacity += after->capacity - before->capacity;
+	stat->conflict += after->conflict - before->conflict;
+}
+
+/* Remember the instruction which issues the following data accesses */
+void report_instruction(Report_t *report, unsigned long addr) {
+	report->pc = addr;
+}
+
+/* Attribute one access to its address range, its instruction and
+ * its marker bracket. The counters of the cache before and after
+ * the access tell the outcome
+ */
+void report_access(Report_t *report, unsigned long addr, Cache_t *before,
+		Cache_t *after) {
+	if (report->has_marker && addr == report->marker_start)
+		report->bracket = report->bracket_num++;
+
+	attr_add(&report->regions, addr >> report->region_bits, before, after);
+	if (report->pc != 0)
+		attr_add(&report->pcs, report->pc, before, after);
+	if (report->bracket != -1)
+		attr_add(&report->brackets, report->bracket, before, after);
+
+	if (report->has_marker && addr == report->marker_end)
+		report->bracket = -1;
+}
+
+/* Order the entries by misses, then evictions */
+int compare_attr_stat(const void *a, const void *b) {
+	attr_stat_t *x = (attr_stat_t *)(*(hash_node_t **)a)->val;
+	attr_stat_t *y = (attr_stat_t *)(*(hash_node_t **)b)->val;
+
+	if (x->misses != y->misses)
+		return y->misses - x->misses;
+	if (x->evictions != y->evictions)
+		return y->evictions - x->evictions;
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/* Print the entries of the table which miss most. kind tells how
+ * to name the key
+ */
+void print_attr_table(Report_t *report, hash_t *hash, char *title, char kind) {
+	hash_node_t **nodes = hash_nodes(hash);
+	attr_stat_t *stat;
+	char name[MAXLINE], range[2 * MAXLINE];
 	int i = 0;
-	/* Find the line which has corresponding tag */
-	for (i = 0; i < cache_sim->line_num; i++) {
-		if (set[i].valid == 1 && set[i].tag == tag) {
-			update_lru(set, i, cache_sim);
-			cache_sim->hits++;
-			
-			if (verbose == 1) 
-				printf("hit ");
 
-			return;
+	if (hash->size == 0) {
+		free(nodes);
+		return;
+	}
+
+	qsort(nodes, hash->size, sizeof(hash_node_t *), compare_attr_stat);
+	printf("%s:\n", title);
+	for (i = 0; i < hash->size && i < TOP_LINES; i++) {
+		stat = (attr_stat_t *)nodes[i]->val;
+		if (kind == 'r') {
+			sprintf(range, "%lx-%lx", stat->key << report->region_bits,
+					((stat->key + 1) << report->region_bits) - 1);
+			if (symbol_name(report, stat->key << report->region_bits, name))
+				sprintf(range + strlen(range), " (%s)", name);
+		}
+		else if (kind == 'i') {
+			sprintf(range, "%lx", stat->key);
+			if (symbol_name(report, stat->key, name))
+				sprintf(range + strlen(range), " (%s)", name);
+		}
+		else {
+			sprintf(range, "bracket %lu", stat->key);
 		}
+		printf("  %-40s hits:%d misses:%d evictions:%d", range,
+				stat->hits, stat->misses, stat->evictions);
+		if (report->classify)
+			printf(" compulsory:%d capacity:%d conflict:%d", stat->compulsory,
+					stat->capacity, stat->conflict);
+		printf("\n");
 	}
-	
-	/* If none of line has the corresponding tag, the status is miss */
-	cache_sim->misses++;
+	free(nodes);
+}
 
-	if (verbose == 1)
-		printf("miss ");
+/* Print the attribution report */
+void print_report(Report_t *report) {
+	print_attr_table(report, &report->regions, "Top missing address ranges", 'r');
+	print_attr_table(report, &report->pcs, "Top missing instructions", 'i');
+	if (report->has_marker)
+		print_attr_table(report, &report->brackets,
+				"Marker brackets (one per traced function)", 'b');
+}
 
-	/* Determine if there exists empty line */
-	for (i = 0; i < cache_sim->line_num; i++) {
-		if (set[i].valid == 0) {
-			set[i].tag = tag;
-			set[i].valid = 1;
-			update_lru(set, i, cache_sim);
+/* Initialize a prefetcher of the kind */
+void prefetch_init(Prefetcher_t *pf, int kind, int degree, int latency) {
+	memset(pf, 0, sizeof(Prefetcher_t));
+	pf->kind = kind;
+	pf->degree = degree;
+	pf->latency = latency;
+	hash_init(&pf->strides, 256);
+	hash_init(&pf->polluted, 1024);
+}
+
+/* Return the block held by a line of the set */
+unsigned long line_block(Line_t *line, int set_addr, Cache_t *cache_sim) {
+	return (line->tag << cache_sim->set_bits) | set_addr;
+}
+
+/* Set or clear the flag of a block evicted by a prefetch */
+void mark_polluted(Prefetcher_t *pf, unsigned long block, int flag) {
+	int *polluted = (int *)hash_find(&pf->polluted, block);
+
+	if (polluted == NULL) {
+		if (flag == 0)
 			return;
-		}
+		polluted = (int *)malloc(sizeof(int));
+		hash_insert(&pf->polluted, block, polluted);
+	}
+	*polluted = flag;
+}
+
+/* Bring the block into the cache ahead of the demand. The data
+ * arrives latency demand accesses later
+ */
+void prefetch_block(Prefetcher_t *pf, Cache_t *cache_sim, unsigned long block,
+		int verbose) {
+	address_t addr_s = get_addr(block << cache_sim->block_bits, cache_sim);
+	Set_t set = cache_sim->sets[addr_s.set_addr];
+	int index = 0;
+
+	if (lookup_line(set, addr_s.tag, cache_sim) != -1)
+		return;
+
+	index = victim_line(set, cache_sim);
+	if (set[index].valid == 1) {
+		pf->evictions++;
+		if (set[index].prefetched)
+			pf->useless++;
+		else
+			mark_polluted(pf, line_block(&set[index], addr_s.set_addr, cache_sim), 1);
 	}
-			
-	/* If it doesn't exist empty find, find the line which 
-	 * has largest lru to evict it */
-	int index = find_line(set, cache_sim);
-	set[index].tag = tag;
+	mark_polluted(pf, block, 0);
+
+	set[index].tag = addr_s.tag;
+	set[index].valid = 1;
+	set[index].prefetched = 1;
+	set[index].ready_at = pf->clock + pf->latency;
 	update_lru(set, index, cache_sim);
-	cache_sim->evictions++;
+	pf->issued++;
 	if (verbose == 1)
-		printf("eviction ");
-	
+		printf("prefetch:%lx ", block << cache_sim->block_bits);
+}
+
+/* Train the stride table with the access. The table is indexed by
+ * the pc, or by the page of the address when the trace has no
+ * instruction. Return the stride once it has been seen twice in a
+ * row, or 0
+ */
+long train_stride(Prefetcher_t *pf, unsigned long addr, unsigned long pc) {
+	unsigned long key = pc != 0 ? pc : addr >> PAGE_BITS;
+	stride_entry_t *entry = (stride_entry_t *)hash_find(&pf->strides, key);
+	long stride = 0;
+
+	if (entry == NULL) {
+		entry = (stride_entry_t *)calloc(1, sizeof(stride_entry_t));
+		entry->last = addr;
+		hash_insert(&pf->strides, key, entry);
+		return 0;
+	}
 
-	return;
+	stride = (long)(addr - entry->last);
+	if (stride != 0 && stride == entry->stride) {
+		if (entry->confidence < 3)
+			entry->confidence++;
+	}
+	else {
+		if (entry->confidence > 0)
+			entry->confidence--;
+		if (entry->confidence == 0)
+			entry->stride = stride;
+	}
+	entry->last = addr;
+	return entry->confidence >= 2 ? entry->stride : 0;
 }
 
+/* Train the streams with the block. A block next to the end of a
+ * stream extends it, otherwise it starts a new stream in place of
+ * the least recently used one. Return the direction of a confirmed
+ * stream, or 0
+ */
+int train_stream(Prefetcher_t *pf, unsigned long block) {
+	stream_t *stream, *victim = &pf->streams[0];
+	long dist = 0;
+	int i = 0;
 
-void modify(address_t addr, Cache_t *cache_sim, int verbose) {
-	load_store(addr, cache_sim, verbose);
-	load_store(addr, cache_sim, verbose);
+	for (i = 0; i < STREAM_NUM; i++) {
+		stream = &pf->streams[i];
+		if (!stream->valid) {
+			victim = stream;
+			continue;
+		}
+		if (victim->valid && stream->used < victim->used)
+			victim = stream;
+
+		dist = (long)(block - stream->last);
+		if (dist == 0 || dist > STREAM_WINDOW || dist < -STREAM_WINDOW)
+			continue;
+		if (stream->dir == 0 || (dist > 0) == (stream->dir > 0)) {
+			if (stream->dir == 0)
+				stream->dir = dist > 0 ? 1 : -1;
+			else if (stream->confidence < 3)
+				stream->confidence++;
+			stream->last = block;
+			stream->used = pf->clock;
+			return stream->confidence >= 1 ? stream->dir : 0;
+		}
+	}
+
+	victim->valid = 1;
+	victim->last = block;
+	victim->dir = 0;
+	victim->confidence = 0;
+	victim->used = pf->clock;
+	return 0;
+}
+
+/* Access the address on demand, then let the prefetcher train on it
+ * and issue its prefetches. A prefetched line used before its data
+ * arrives is a late prefetch, and the demand still waits for it, so
+ * it counts as a miss
+ */
+void prefetch_access(Prefetcher_t *pf, Cache_t *cache_sim, unsigned long addr,
+		unsigned long pc, int verbose) {
+	address_t addr_s = get_addr(addr, cache_sim);
+	Set_t set = cache_sim->sets[addr_s.set_addr];
+	unsigned long block = addr >> cache_sim->block_bits;
+	int index = lookup_line(set, addr_s.tag, cache_sim);
+	int trigger = 0, late = 0, dir = 0, i = 0;
+	int *polluted;
+	long stride = 0;
+
+	pf->clock++;
+
+	if (index != -1) {
+		if (set[index].prefetched) {
+			set[index].prefetched = 0;
+			trigger = 1;
+			if (pf->clock <= set[index].ready_at) {
+				pf->late++;
+				late = 1;
+				cache_sim->hits--;
+				cache_sim->misses++;
+			}
+			else {
+				pf->useful++;
+			}
+		}
+	}
+	else {
+		trigger = 1;
+		polluted = (int *)hash_find(&pf->polluted, block);
+		if (polluted != NULL && *polluted) {
+			*polluted = 0;
+			pf->polluting++;
+		}
+		/* load_store is going to fill the same victim */
+		index = victim_line(set, cache_sim);
+		if (set[index].valid == 1 && set[index].prefetched)
+			pf->useless++;
+	}
+
+	/* A late prefetch is counted as a miss, so it is printed as one
+	 * instead of the hit load_store sees */
+	if (late && verbose == 1)
+		printf("late-prefetch miss ");
+	load_store(addr_s, cache_sim, late ? 0 : verbose);
+	set[index].prefetched = 0;
+
+	switch (pf->kind) {
+		case PREFETCH_NEXT:
+			/* Tagged next-line: on a miss or on the first use of a
+			 * prefetched line */
+			if (trigger) {
+				for (i = 1; i <= pf->degree; i++)
+					prefetch_block(pf, cache_sim, block + i, verbose);
+			}
+			break;
+		case PREFETCH_STRIDE:
+			stride = train_stride(pf, addr, pc);
+			for (i = 1; stride != 0 && i <= pf->degree; i++)
+				prefetch_block(pf, cache_sim,
+						(addr + stride * i) >> cache_sim->block_bits, verbose);
+			break;
+		case PREFETCH_STREAM:
+			if (trigger)
+				dir = train_stream(pf, block);
+			for (i = 1; dir != 0 && i <= pf->degree; i++)
+				prefetch_block(pf, cache_sim, block + dir * i, verbose);
+			break;
+	}
+}
+
+/* Print the statistics of the prefetcher */
+void print_prefetch(Prefetcher_t *pf) {
+	char *names[] = {"none", "next", "stride", "stream"};
+
+	printf("prefetch (%s, degree %d, latency %d): issued:%d useful:%d late:%d "
+			"useless:%d polluting:%d evictions:%d\n", names[pf->kind],
+			pf->degree, pf->latency, pf->issued, pf->useful, pf->late,
+			pf->useless, pf->polluting, pf->evictions);
+}
+
+/* Initialize the classifier for a cache of the geometry */
+void classifier_init(Classifier_t *cls, Cache_t *cache_sim) {
+	hash_init(&cls->seen, 1024);
+	hash_init(&cls->shadow_map, 1024);
+	cls->head.prev = cls->head.next = &cls->head;
+	cls->capacity = cache_sim->set_num * cache_sim->line_num;
+}
+
+/* Access the block in the fully associative LRU shadow cache,
+ * return 1 on a hit
+ */
+int shadow_access(Classifier_t *cls, unsigned long block) {
+	shadow_node_t *node = (shadow_node_t *)hash_find(&cls->shadow_map, block);
+	int hit = node != NULL;
+
+	if (hit) {
+		/* Unlink it to move it to the front */
+		node->prev->next = node->next;
+		node->next->prev = node->prev;
+	}
+	else {
+		if (cls->shadow_map.size == cls->capacity) {
+			/* Reuse the node of the least recently used block */
+			node = cls->head.prev;
+			node->prev->next = &cls->head;
+			cls->head.prev = node->prev;
+			hash_remove(&cls->shadow_map, node->block);
+		}
+		else {
+			node = (shadow_node_t *)malloc(sizeof(shadow_node_t));
+		}
+		node->block = block;
+		hash_insert(&cls->shadow_map, block, node);
+	}
+
+	node->next = cls->head.next;
+	node->prev = &cls->head;
+	cls->head.next->prev = node;
+	cls->head.next = node;
+	return hit;
+}
+
+/* Classify the miss of the access, if any. The counters of the
+ * cache before the access tell whether it missed
+ */
+void classify_access(Classifier_t *cls, unsigned long addr, Cache_t *before,
+		Cache_t *cache_sim, int verbose) {
+	unsigned long block = addr >> cache_sim->block_bits;
+	int first = hash_find(&cls->seen, block) == NULL;
+	int shadow_hit = shadow_access(cls, block);
+
+	if (first)
+		hash_insert(&cls->seen, block, &cls->seen);
+
+	if (cache_sim->misses == before->misses)
+		return;
+
+	if (first) {
+		cache_sim->compulsory++;
+		if (verbose == 1)
+			printf("compulsory ");
+	}
+	else if (!shadow_hit) {
+		cache_sim->capacity++;
+		if (verbose == 1)
+			printf("capacity ");
+	}
+	else {
+		cache_sim->conflict++;
+		if (verbose == 1)
+			printf("conflict ");
+	}
 }
 
 void print_help_menu(){
-	printf("\n\nUsage: ./csim [-hv] -s <s> -E <E> -b <b> -t <tracefile>\n");
+	printf("\n\nUsage: ./csim [-hv] -s <s> -E <E> -b <b> -t <tracefile> [-j <n>]\n");
+	printf("       ./csim [-hv] -s <s> -E <E> -b <b> -t <tracefile> -c <n> [-m <mesi|moesi>]\n");
 	printf("-h:             Optional help flag that prints usage info\n");
 	printf("-v:             Optional verbose flag that displays trace info\n");
 	printf("-s <s>:         Number of set index bits(S = 2^s is the number of sets)\n");
 	printf("-E <E>:         Associativity (number of lines per set)\n");
 	printf("-b <b>:         Number of block bit(b = 2^b is the block size)\n");
-	printf("-t <tracefile>: Name of the valgrind trace to replay\n\n\n");
+	printf("-t <tracefile>: Name of the valgrind trace to replay\n");
+	printf("-j <n>:         Optional number of threads, the sets are split among them\n");
+	printf("-c <n>:         Simulate n cores with private caches, the trace lines carry a core id\n");
+	printf("-m <protocol>:  Coherence protocol of the cores, mesi (default) or moesi\n");
+	printf("-a:             Attribute hits, misses and evictions to address ranges and instructions\n");
+	printf("-r <r>:         Number of bits of an address range of -a (default 12)\n");
+	printf("-y <symfile>:   Name the addresses of -a with the output of \"nm -S\"\n");
+	printf("-k <markfile>:  Attribute -a to the MARKER_START/MARKER_END brackets of tracegen\n");
+	printf("-p <kind>:      Model a hardware prefetcher, next, stride or stream\n");
+	printf("-d <d>:         Number of blocks the prefetcher fetches ahead (default 1)\n");
+	printf("-l <l>:         Demand accesses before the prefetched data arrives (default 0)\n");
+	printf("-3:             Classify the misses into compulsory, capacity and conflict\n\n\n");
 }
 
 int main(int argc, char ** argv) {
-	int s, E, b, verbose = 0;
+	int s, E, b, verbose = 0, nthreads = 1, ncores = 0;
+	int protocol = PROTOCOL_MESI;
+	int attribute = 0, region_bits = 12;
+	char *symfile = NULL, *markfile = NULL;
+	int prefetch = PREFETCH_NONE, degree = 1, latency = 0;
+	int classify = 0;
 	char *filename = NULL;
-	int c = getopt(argc, argv, "hvs:E:b:t");
+	int c = getopt(argc, argv, "hvs:E:b:t:j:c:m:ar:y:k:p:d:l:3");
 
 	if (c == -1){
 		print_help_menu();
@@ -205,61 +1247,150 @@ int main(int argc, char ** argv) {
 
 	do{
 		switch(c) {
-            case 'v':
-                verbose = 1;
-                break;
-            case 's':
-                s = atoi(optarg);
-                break;
-            case 'E':
-                E = atoi(optarg);
-                break;
-            case 'b':
-                b = atoi(optarg);
-                break;
-            case 't':
-                filename = optarg;
-                break;
-            default:
-                print_help_menu();
-                return -1;
-        }
-    }while((c = getopt(argc, argv, "hvs:E:b:t:")) != -1);
-    Cache_t *cache_sim = (Cache_t *)malloc(sizeof(Cache_t));
-	
-    cache_init(cache_sim, s, E, b);
-
-	int addr;
-	int block_size = 0;
-	char opt[2];
-	address_t addr_s;
+			case 'v':
+				verbose = 1;
+				break;
+			case 's':
+				s = atoi(optarg);
+				break;
+			case 'E':
+				E = atoi(optarg);
+				break;
+			case 'b':
+				b = atoi(optarg);
+				break;
+			case 't':
+				filename = optarg;
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'c':
+				ncores = atoi(optarg);
+				break;
+			case 'm':
+				if (strcmp(optarg, "mesi") == 0)
+					protocol = PROTOCOL_MESI;
+				else if (strcmp(optarg, "moesi") == 0)
+					protocol = PROTOCOL_MOESI;
+				else {
+					print_help_menu();
+					return -1;
+				}
+				break;
+			case 'a':
+				attribute = 1;
+				break;
+			case 'r':
+				region_bits = atoi(optarg);
+				break;
+			case 'y':
+				symfile = optarg;
+				break;
+			case 'k':
+				markfile = optarg;
+				break;
+			case 'p':
+				if (strcmp(optarg, "next") == 0)
+					prefetch = PREFETCH_NEXT;
+				else if (strcmp(optarg, "stride") == 0)
+					prefetch = PREFETCH_STRIDE;
+				else if (strcmp(optarg, "stream") == 0)
+					prefetch = PREFETCH_STREAM;
+				else {
+					print_help_menu();
+					return -1;
+				}
+				break;
+			case 'd':
+				degree = atoi(optarg);
+				break;
+			case 'l':
+				latency = atoi(optarg);
+				break;
+			case '3':
+				classify = 1;
+				break;
+			default:
+				print_help_menu();
+				return -1;
+		}
+	}while((c = getopt(argc, argv, "hvs:E:b:t:j:c:m:ar:y:k:p:d:l:3")) != -1);
+
+	if (nthreads < 1 || nthreads > MAX_THREADS || ncores < 0 || ncores > MAX_CORES ||
+			degree < 1 || latency < 0) {
+		print_help_menu();
+		return -1;
+	}
 
 	FILE *file = fopen(filename, "r");
 
-    while(fscanf(file,"%s %x,%d",opt,&addr,&block_size) != EOF) {
-    	if(verbose == 1)
-			printf("%s %x,%d ",opt,addr,block_size);
-		
-		if (opt[0] == 'I') {
-			if (verbose == 1)
-				printf("\n");
-			continue;
-		}
+	if (ncores > 0) {
+		Multicore_t mc;
+		int hits = 0, misses = 0, evictions = 0;
+		int i = 0;
 
-    	addr_s = get_addr(addr, cache_sim);
+		mc.core_num = ncores;
+		mc.protocol = protocol;
+		mc.cores = (Cache_t *)malloc(sizeof(Cache_t) * ncores);
+		for (i = 0; i < ncores; i++)
+			cache_init(&mc.cores[i], s, E, b);
+		hash_init(&mc.line_stats, 1024);
 
-    	if (opt[0] == 'M')
-    		modify(addr_s, cache_sim, verbose);
+		run_multicore(file, &mc, verbose);
+		fclose(file);
 
-		if (opt[0] == 'L')
-    		load_store(addr_s, cache_sim, verbose);
+		for (i = 0; i < ncores; i++) {
+			hits += mc.cores[i].hits;
+			misses += mc.cores[i].misses;
+			evictions += mc.cores[i].evictions;
+		}
+		printSummary(hits, misses, evictions);
+		print_multicore(&mc);
+		return 0;
+	}
 
-		if (opt[0] == 'S')
-    		load_store(addr_s, cache_sim, verbose);
+	Cache_t *cache_sim = (Cache_t *)malloc(sizeof(Cache_t));
+	cache_init(cache_sim, s, E, b);
+
+	Report_t *report = NULL;
+	if (attribute) {
+		report = (Report_t *)malloc(sizeof(Report_t));
+		report_init(report, region_bits);
+		report->classify = classify;
+		if (symfile != NULL && load_symbols(report, symfile) < 0)
+			fprintf(stderr, "Cannot read the symbol map %s\n", symfile);
+		if (markfile != NULL && load_marker(report, markfile) < 0)
+			fprintf(stderr, "Cannot read the marker file %s\n", markfile);
+	}
 
-    	if (verbose == 1)
-    		printf("\n");
+	Prefetcher_t *pf = NULL;
+	if (prefetch != PREFETCH_NONE) {
+		pf = (Prefetcher_t *)malloc(sizeof(Prefetcher_t));
+		prefetch_init(pf, prefetch, degree, latency);
 	}
+
+	Classifier_t *cls = NULL;
+	if (classify) {
+		cls = (Classifier_t *)malloc(sizeof(Classifier_t));
+		classifier_init(cls, cache_sim);
+	}
+
+	/* The verbose output, the report, the prefetcher and the
+	 * classifier must follow the order of the trace */
+	if (nthreads > 1 && verbose == 0 && report == NULL && pf == NULL && cls == NULL)
+		run_parallel(file, cache_sim, nthreads);
+	else
+		run_sequential(file, cache_sim, verbose, report, pf, cls);
+
+	fclose(file);
 	printSummary(cache_sim->hits, cache_sim->misses, cache_sim->evictions);
-    return 0;
+	if (cls != NULL)
+		printf("compulsory:%d capacity:%d conflict:%d\n", cache_sim->compulsory,
+				cache_sim->capacity, cache_sim->conflict);
+	if (pf != NULL)
+		print_prefetch(pf);
+	if (report != NULL)
+		print_report(report);
+	return 0;
 }
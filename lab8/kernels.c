@@ -0,0 +1,309 @@
+/*
+ * kernels.c - Blocked matrix kernels other than transpose
+ *
+ * Each kernel has a prototype of the form:
+ * void kernel(int M, int N, int *A, int *B, int *C);
+ *
+ * and comes in a naive and a blocked version, registered together with
+ * a checker that recomputes the result. The matrices are flat, every
+ * kernel views them with the shapes it needs:
+ *
+ *   GEMM             C[N][N] = A[N][M] * B[M][N]
+ *   5-point stencil  B[N][M] = 4 A[i][j] - the four neighbours of A[i][j],
+ *                    border elements copied from A
+ *   Strided copy     B[N][M] = A[N][M], walking A down its columns
+ *
+ * As in trans.c, A, B and C are accessed through LOAD() and STORE(),
+ * so that test-trans -k can trace the kernels in process.
+ *
+ * The cache of the lab is direct-mapped, and A, B and C lie at whatever
+ * offsets malloc gave them, so a tile of one evicts the tiles of the
+ * others, and rows of a power of two length alias within a tile. The
+ * blocked kernels therefore copy their tiles into local arrays, as the
+ * transposes of trans.c do with registers: a block is read whole into
+ * them and written whole from them, and what else is in the cache
+ * meanwhile no longer matters.
+ */
+#include <stdio.h>
+#include "cachelab.h"
+
+/* Side of a tile. A row of 8 ints fills a 32-byte block */
+#define KERNEL_TILE 8
+
+/* Width of the column strips of the blocked stencil, 8 blocks. The
+ * columns on either side of a strip are read with it, so a wider strip
+ * reads fewer blocks twice */
+#define STENCIL_STRIP 64
+
+/* Bytes covered by the sets of the 1KB cache, 32 sets of 32-byte
+ * blocks, as in trans.c */
+#define KERNEL_SPAN 1024
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/*
+ * kernel_period - Return after how many rows of stride ints the rows
+ *     come back to the same sets of the cache
+ */
+static int kernel_period(int stride)
+{
+	int a = KERNEL_SPAN, b = stride * (int)sizeof(int), t;
+
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return KERNEL_SPAN / a;
+}
+
+/*
+ * gemm_naive - C = A * B, one dot product per element of C
+ */
+char gemm_naive_desc[] = "GEMM, naive ijk";
+void gemm_naive(int M, int N, int *pa, int *pb, int *pc)
+{
+	int (*A)[M] = (int (*)[M])pa;
+	int (*B)[N] = (int (*)[N])pb;
+	int (*C)[N] = (int (*)[N])pc;
+	int i, j, k, sum;
+
+	for (i = 0; i < N; i++) {
+		for (j = 0; j < N; j++) {
+			sum = 0;
+			for (k = 0; k < M; k++)
+				sum += LOAD(A[i][k]) * LOAD(B[k][j]);
+			STORE(C[i][j], sum);
+		}
+	}
+}
+
+/*
+ * gemm_blocked - C = A * B over KERNEL_TILE cubes, in ikj order. A
+ *     cube works on local copies of its tiles of A, B and C, each read
+ *     a row at a time, and the tile of C is written back after it: the
+ *     blocks of one tile do not evict those of another meanwhile, and
+ *     the tile of A is read once for a whole row of cubes.
+ */
+char gemm_blocked_desc[] = "GEMM, blocked ikj";
+void gemm_blocked(int M, int N, int *pa, int *pb, int *pc)
+{
+	int (*A)[M] = (int (*)[M])pa;
+	int (*B)[N] = (int (*)[N])pb;
+	int (*C)[N] = (int (*)[N])pc;
+	int i0, j0, k0, i, j, k, ni, nj, nk, a;
+	int ta[KERNEL_TILE][KERNEL_TILE], tb[KERNEL_TILE][KERNEL_TILE];
+	int tc[KERNEL_TILE][KERNEL_TILE];
+
+	for (i0 = 0; i0 < N; i0 += KERNEL_TILE) {
+		ni = MIN(KERNEL_TILE, N - i0);
+		for (k0 = 0; k0 < M; k0 += KERNEL_TILE) {
+			nk = MIN(KERNEL_TILE, M - k0);
+			for (i = 0; i < ni; i++)
+				for (k = 0; k < nk; k++)
+					ta[i][k] = LOAD(A[i0+i][k0+k]);
+			for (j0 = 0; j0 < N; j0 += KERNEL_TILE) {
+				nj = MIN(KERNEL_TILE, N - j0);
+				for (k = 0; k < nk; k++)
+					for (j = 0; j < nj; j++)
+						tb[k][j] = LOAD(B[k0+k][j0+j]);
+				for (i = 0; i < ni; i++)
+					for (j = 0; j < nj; j++)
+						tc[i][j] = k0 == 0 ? 0 : LOAD(C[i0+i][j0+j]);
+				for (i = 0; i < ni; i++)
+					for (k = 0; k < nk; k++) {
+						a = ta[i][k];
+						for (j = 0; j < nj; j++)
+							tc[i][j] += a * tb[k][j];
+					}
+				for (i = 0; i < ni; i++)
+					for (j = 0; j < nj; j++)
+						STORE(C[i0+i][j0+j], tc[i][j]);
+			}
+		}
+	}
+}
+
+/*
+ * check_gemm - Compare C with the product of A and B
+ */
+int check_gemm(int M, int N, int *pa, int *pb, int *pc)
+{
+	int (*A)[M] = (int (*)[M])pa;
+	int (*B)[N] = (int (*)[N])pb;
+	int (*C)[N] = (int (*)[N])pc;
+	int i, j, k, sum;
+
+	for (i = 0; i < N; i++) {
+		for (j = 0; j < N; j++) {
+			sum = 0;
+			for (k = 0; k < M; k++)
+				sum += A[i][k] * B[k][j];
+			if (C[i][j] != sum)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * stencil_point - The stencil at A[i][j]
+ */
+static int stencil_point(int M, int N, int A[N][M], int i, int j)
+{
+	if (i == 0 || j == 0 || i == N - 1 || j == M - 1)
+		return LOAD(A[i][j]);
+	return 4 * LOAD(A[i][j]) - LOAD(A[i-1][j]) - LOAD(A[i+1][j])
+		- LOAD(A[i][j-1]) - LOAD(A[i][j+1]);
+}
+
+/*
+ * stencil_naive - 5-point stencil sweeping A row by row
+ */
+char stencil_naive_desc[] = "5-point stencil, row sweep";
+void stencil_naive(int M, int N, int *pa, int *pb, int *pc)
+{
+	int (*A)[M] = (int (*)[M])pa;
+	int (*B)[M] = (int (*)[M])pb;
+	int i, j;
+
+	for (i = 0; i < N; i++)
+		for (j = 0; j < M; j++)
+			STORE(B[i][j], stencil_point(M, N, A, i, j));
+}
+
+/*
+ * stencil_blocked - 5-point stencil sweeping A in column strips of
+ *     STENCIL_STRIP elements. The three rows of the strip a row of B
+ *     needs, with a column on either side, are kept in a local window
+ *     which moves down one row of A at a time, so each row of the
+ *     strip is read once even where the rows of A and B alias.
+ */
+char stencil_blocked_desc[] = "5-point stencil, column strips";
+void stencil_blocked(int M, int N, int *pa, int *pb, int *pc)
+{
+	int (*A)[M] = (int (*)[M])pa;
+	int (*B)[M] = (int (*)[M])pb;
+	int i, j, j0, lo, hi, up, mid, down, v;
+	int win[3][STENCIL_STRIP + 2];
+
+	for (j0 = 0; j0 < M; j0 += STENCIL_STRIP) {
+		/* Columns lo..hi of A are read, win[r][j - lo] */
+		lo = j0 > 0 ? j0 - 1 : 0;
+		hi = MIN(j0 + STENCIL_STRIP, M - 1);
+		for (i = 0; i < N; i++) {
+			mid = i % 3;
+			up = (i + 2) % 3;
+			down = (i + 1) % 3;
+			if (i == 0)
+				for (j = lo; j <= hi; j++)
+					win[mid][j - lo] = LOAD(A[i][j]);
+			if (i + 1 < N)
+				for (j = lo; j <= hi; j++)
+					win[down][j - lo] = LOAD(A[i+1][j]);
+			for (j = j0; j < MIN(j0 + STENCIL_STRIP, M); j++) {
+				v = win[mid][j - lo];
+				if (i > 0 && j > 0 && i < N - 1 && j < M - 1)
+					v = 4 * v - win[up][j - lo] - win[down][j - lo]
+						- win[mid][j - 1 - lo] - win[mid][j + 1 - lo];
+				STORE(B[i][j], v);
+			}
+		}
+	}
+}
+
+/*
+ * check_stencil - Compare B with the stencil of A
+ */
+int check_stencil(int M, int N, int *pa, int *pb, int *pc)
+{
+	int (*A)[M] = (int (*)[M])pa;
+	int (*B)[M] = (int (*)[M])pb;
+	int i, j, v;
+
+	for (i = 0; i < N; i++) {
+		for (j = 0; j < M; j++) {
+			if (i == 0 || j == 0 || i == N - 1 || j == M - 1)
+				v = A[i][j];
+			else
+				v = 4 * A[i][j] - A[i-1][j] - A[i+1][j]
+					- A[i][j-1] - A[i][j+1];
+			if (B[i][j] != v)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * copy_naive - Copy A into B column by column, a stride of M ints
+ */
+char copy_naive_desc[] = "Strided copy, column walk";
+void copy_naive(int M, int N, int *pa, int *pb, int *pc)
+{
+	int (*A)[M] = (int (*)[M])pa;
+	int (*B)[M] = (int (*)[M])pb;
+	int i, j;
+
+	for (j = 0; j < M; j++)
+		for (i = 0; i < N; i++)
+			STORE(B[i][j], LOAD(A[i][j]));
+}
+
+/*
+ * copy_blocked - Copy A into B column by column inside tiles one block
+ *     wide, so that every block of a tile is reused before it leaves
+ *     the cache. A tile is as many rows high as the rows of A take to
+ *     alias, up to KERNEL_TILE, and goes through a local array: its
+ *     columns are read down A, then its rows written to B, which
+ *     would otherwise evict the blocks of A under it.
+ */
+char copy_blocked_desc[] = "Strided copy, blocked";
+void copy_blocked(int M, int N, int *pa, int *pb, int *pc)
+{
+	int (*A)[M] = (int (*)[M])pa;
+	int (*B)[M] = (int (*)[M])pb;
+	int i0, j0, i, j, ni, nj;
+	int h = MIN(KERNEL_TILE, kernel_period(M));
+	int tile[KERNEL_TILE][KERNEL_TILE];
+
+	for (j0 = 0; j0 < M; j0 += KERNEL_TILE) {
+		nj = MIN(KERNEL_TILE, M - j0);
+		for (i0 = 0; i0 < N; i0 += h) {
+			ni = MIN(h, N - i0);
+			for (j = 0; j < nj; j++)
+				for (i = 0; i < ni; i++)
+					tile[i][j] = LOAD(A[i0+i][j0+j]);
+			for (i = 0; i < ni; i++)
+				for (j = 0; j < nj; j++)
+					STORE(B[i0+i][j0+j], tile[i][j]);
+		}
+	}
+}
+
+/*
+ * check_copy - Compare B with A
+ */
+int check_copy(int M, int N, int *pa, int *pb, int *pc)
+{
+	int i;
+
+	for (i = 0; i < M * N; i++)
+		if (pb[i] != pa[i])
+			return 0;
+	return 1;
+}
+
+/*
+ * registerKernels - This function registers the kernels with the
+ *     driver, the way registerFunctions() registers the transposes.
+ */
+void registerKernels()
+{
+	registerKernelFunction(gemm_naive, check_gemm, gemm_naive_desc);
+	registerKernelFunction(gemm_blocked, check_gemm, gemm_blocked_desc);
+	registerKernelFunction(stencil_naive, check_stencil, stencil_naive_desc);
+	registerKernelFunction(stencil_blocked, check_stencil, stencil_blocked_desc);
+	registerKernelFunction(copy_naive, check_copy, copy_naive_desc);
+	registerKernelFunction(copy_blocked, check_copy, copy_blocked_desc);
+}
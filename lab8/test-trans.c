@@ -3,6 +3,7 @@
  *     student's transpose functions and records the results for their
  *     official submitted version as well.
  */
+#define _GNU_SOURCE /* syscall() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -11,28 +12,62 @@
 #include <signal.h>
 #include <getopt.h>
 #include <sys/types.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include "cachelab.h"
+#include "cachesim.h"
 #include <sys/wait.h> // fir WEXITSTATUS
 #include <limits.h> // for INT_MAX
 
 /* Maximum array dimension */
 #define MAXN 256
 
+/* Repetitions timed for every thread count of -p, every kernel of -k,
+   and every function of -b on a MAXN x MAXN matrix */
+#define BENCH_REPS 10
+
+/* Hardware counters read by -e */
+#define PERF_COUNTERS 2
+
 /* The description string for the transpose_submit() function that the
    student submits for credit */
 #define SUBMIT_DESCRIPTION "Transpose submission"
 
-/* External function defined in trans.c */
+/* External functions defined in trans.c */
 extern void registerFunctions();
+extern void registerKernels();
+extern int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+
+/* From trans-native.o, trans.c optimized and not traced, for the
+   timings */
+extern void native_registerFunctions();
+extern void native_touch_parallel(int M, int N, int B[M][N], int nthreads);
+extern void native_trans_parallel_n(int M, int N, int A[N][M], int B[M][N],
+                                    int nthreads);
+
+/* From kernels-native.o, kernels.c optimized and not traced */
+extern void native_registerKernels();
 
 /* External variables defined in cachelab-tools.c */
 extern trans_func_t func_list[MAX_TRANS_FUNCS];
 extern int func_counter; 
+extern kernel_func_t kernel_list[MAX_KERNEL_FUNCS];
+extern int kernel_counter;
 
 /* Globals set on the command line */
 static int M = 0;
 static int N = 0;
 
+/* Shapes swept by -k and -b without -M and -N */
+static int sweep_shapes[][2] = {{32, 32}, {64, 64}, {61, 67}, {256, 256}};
+
+/* Read miss counters of the L1 data cache and the last level cache,
+   -1 if not open */
+static char *perf_names[PERF_COUNTERS] = {"L1D", "LLC"};
+static int perf_fds[PERF_COUNTERS] = {-1, -1};
+
 /* The correctness and performance for the submitted transpose function */
 struct results {
     int funcid;
@@ -41,22 +76,90 @@ struct results {
 };
 static struct results results = {-1, 0, INT_MAX};
 
+/* Matrices and cache model of the in-process evaluation */
+static int A[MAXN][MAXN];
+static int B[MAXN][MAXN];
+static Cache_t trace_cache;
+
+/* The functions of trans-native.o and the kernels of kernels-native.o,
+   in the order of func_list and kernel_list */
+static void (*native_funcs[MAX_TRANS_FUNCS])(int M, int N, int[N][M], int[M][N]);
+static int native_func_counter = 0;
+static kernel_t native_kernels[MAX_KERNEL_FUNCS];
+static int native_kernel_counter = 0;
+
+/*
+ * native_registerTransFunction - What registerFunctions() of
+ *     trans-native.o calls instead of registerTransFunction()
+ */
+void native_registerTransFunction(void (*trans)(int M, int N, int[N][M],
+                                                int[M][N]), char *desc)
+{
+    assert(native_func_counter < MAX_TRANS_FUNCS);
+    native_funcs[native_func_counter++] = trans;
+}
+
+/*
+ * native_registerKernelFunction - What registerKernels() of
+ *     kernels-native.o calls instead of registerKernelFunction()
+ */
+void native_registerKernelFunction(kernel_t kernel, kernel_check_t check,
+                                   char *desc)
+{
+    assert(native_kernel_counter < MAX_KERNEL_FUNCS);
+    native_kernels[native_kernel_counter++] = kernel;
+}
+
+/*
+ * record_perf - Record the performance of function i
+ */
+void record_perf(int i, unsigned int hits, unsigned int misses,
+                 unsigned int evictions)
+{
+    func_list[i].num_hits = hits;
+    func_list[i].num_misses = misses;
+    func_list[i].num_evictions = evictions;
+    printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n",
+           i, func_list[i].description, hits, misses, evictions);
+
+    /* If it is transpose_submit(), record number of misses */
+    if (results.funcid == i) {
+        results.misses = misses;
+    }
+}
+
+/*
+ * read_markers - Read the marker addresses tracegen records before it
+ *     runs the function. Return 0 if the file is not complete yet.
+ */
+int read_markers(unsigned long long *start, unsigned long long *end)
+{
+    FILE *marker_fp = fopen(".marker", "r");
+    int n;
+
+    if (marker_fp == NULL)
+        return 0;
+    n = fscanf(marker_fp, "%llx %llx", start, end);
+    fclose(marker_fp);
+    return n == 2;
+}
+
 /* 
- * eval_perf - Evaluate the performance of the registered transpose functions
+ * eval_perf - Evaluate the performance of the registered transpose
+ *     functions. The output of valgrind is read from a pipe as it is
+ *     produced, and the accesses between the markers go straight into
+ *     the cache model, so no trace file is written.
  */
 void eval_perf(unsigned int s, unsigned int E, unsigned int b)
 {
-    int i,flag;
-    unsigned int len, hits, misses, evictions;
-    unsigned long long int marker_start, marker_end, addr;
+    int i, flag, known, status;
+    unsigned int len;
+    unsigned long long int marker_start = 0, marker_end = 0, addr;
     char buf[1000], cmd[255];
-    char filename[128];
+    FILE* trace_fp;
 
     registerFunctions(); 
-
-    /* Open the complete trace file */
-    FILE* full_trace_fp;  
-    FILE* part_trace_fp; 
+    cache_init(&trace_cache, s, E, b);
 
     /* Evaluate the performance of each registered transpose function */
 
@@ -65,47 +168,36 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
             results.funcid = i; /* remember which function is the submission */
 
 
-        printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
-        /* Use valgrind to generate the trace */
-
-        sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d  > trace.tmp", M, N,i);
-        flag=WEXITSTATUS(system(cmd));
-        if (0!=flag) {
-            printf("Validation error at function %d! Run ./tracegen -M %d -N %d -F %d for details.\nSkipping performance evaluation for this function.\n",flag-1,M,N,i);      
-            continue;
-        }
-
-        /* Get the start and end marker addresses */
-        FILE* marker_fp = fopen(".marker", "r");
-        assert(marker_fp);
-        fscanf(marker_fp, "%llx %llx", &marker_start, &marker_end);
-        fclose(marker_fp);
-
-
-        func_list[i].correct=1;
-
-        /* Save the correctness of the transpose submission */
-        if (results.funcid == i ) {
-            results.correct = 1;
-        }
-
-        full_trace_fp = fopen("trace.tmp", "r");
-        assert(full_trace_fp);
-
+        printf("\nFunction %d (%d total)\nStep 1: Validating and streaming memory traces\n",i,func_counter);
+        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
 
-        /* Filtered trace for each transpose function goes in a separate file */
-        sprintf(filename, "trace.f%d", i);
-        part_trace_fp = fopen(filename, "w");
-        assert(part_trace_fp);
+        /* Use valgrind to generate the trace. A stale marker file
+           would match the wrong addresses, so remove it first */
+        unlink(".marker");
+        sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d", M, N, i);
+        trace_fp = popen(cmd, "r");
+        assert(trace_fp);
+        cache_reset(&trace_cache);
     
-        /* Locate trace corresponding to the trans function */
+        /* Simulate the trace corresponding to the trans function,
+           reading to the end so that tracegen can validate it */
         flag = 0;
-        while (fgets(buf, 1000, full_trace_fp) != NULL) {
+        known = 0;
+        while (fgets(buf, 1000, trace_fp) != NULL) {
 
             /* We are only interested in memory access instructions */
             if (buf[0]==' ' && buf[2]==' ' &&
                 (buf[1]=='S' || buf[1]=='M' || buf[1]=='L' )) {
-                sscanf(buf+3, "%llx,%u", &addr, &len);
+                if (sscanf(buf+3, "%llx,%u", &addr, &len) != 2)
+                    continue;
+
+                /* tracegen records the markers before it stores to
+                   the start marker, a one byte store, so the file is
+                   complete by the time that store is read */
+                if (!known && buf[1]=='S' && len==1)
+                    known = read_markers(&marker_start, &marker_end);
+                if (!known)
+                    continue;
         
                 /* If start marker found, set flag */
                 if (addr == marker_start)
@@ -121,52 +213,395 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
                    eliminate the valgrind stack references while
                    include the student stack references. */
                 if (flag && addr < 0xffffffff) {
-                    fputs(buf, part_trace_fp);
+                    cache_access(&trace_cache, addr);
+                    if (buf[1]=='M')
+                        cache_access(&trace_cache, addr);
                 }
 
-                /* if end marker found, close trace file */
-                if (addr == marker_end) {
+                /* if end marker found, stop simulating */
+                if (addr == marker_end)
                     flag = 0;
-                    fclose(part_trace_fp);
-                    break;
-                }
             }
         }
-        fclose(full_trace_fp);
+        status = pclose(trace_fp);
+        flag = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        if (0!=flag) {
+            printf("Validation error at function %d! Run ./tracegen -M %d -N %d -F %d for details.\nSkipping performance evaluation for this function.\n",i,M,N,i);      
+            continue;
+        }
+
+        func_list[i].correct=1;
+
+        /* Save the correctness of the transpose submission */
+        if (results.funcid == i ) {
+            results.correct = 1;
+        }
+
+        record_perf(i, trace_cache.hits, trace_cache.misses,
+                    trace_cache.evictions);
+    }
+    cache_free(&trace_cache);
+}
+
+/*
+ * trace_to_cache - Feed an access of the traced function to the model
+ */
+void trace_to_cache(void *addr, int size, char op)
+{
+    cache_access(&trace_cache, (unsigned long)addr);
+}
+
+/* 
+ * eval_perf_inproc - Evaluate the performance of the registered
+ *     transpose functions without valgrind. The functions are built
+ *     with -DTRACE_TRANS, so their accesses to A and B go straight to
+ *     the cache model. Unlike the valgrind trace, the two marker
+ *     accesses are not counted.
+ */
+void eval_perf_inproc(unsigned int s, unsigned int E, unsigned int b)
+{
+    int i;
+
+    registerFunctions(); 
+    cache_init(&trace_cache, s, E, b);
+
+    for (i=0; i<func_counter; i++) {
+        if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0 )
+            results.funcid = i; /* remember which function is the submission */
+
+        printf("\nFunction %d (%d total)\nStep 1: Validating and tracing in process\n",i,func_counter);
+        initMatrix(M, N, A, B);
+        cache_reset(&trace_cache);
+        setTraceHook(trace_to_cache);
+        (*func_list[i].func_ptr)(M, N, A, B);
+        setTraceHook(NULL);
+
+        if (!is_transpose(M, N, A, B)) {
+            printf("Validation error at function %d!\nSkipping performance evaluation for this function.\n", i);
+            continue;
+        }
+        func_list[i].correct=1;
+
+        /* Save the correctness of the transpose submission */
+        if (results.funcid == i ) {
+            results.correct = 1;
+        }
 
-        /* Run the reference simulator */
         printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
-        char cmd[255];
-        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t trace.f%d > /dev/null", 
-                s, E, b, i);
-        system(cmd);
-    
-        /* Collect results from the reference simulator */
-        FILE* in_fp = fopen(".csim_results","r");
-        assert(in_fp);
-        fscanf(in_fp, "%u %u %u", &hits, &misses, &evictions);
-        fclose(in_fp);
-        func_list[i].num_hits = hits;
-        func_list[i].num_misses = misses;
-        func_list[i].num_evictions = evictions;
-        printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n",
-               i, func_list[i].description, hits, misses, evictions);
-    
-        /* If it is transpose_submit(), record number of misses */
-        if (results.funcid == i) {
-            results.misses = misses;
+        record_perf(i, trace_cache.hits, trace_cache.misses,
+                    trace_cache.evictions);
+    }
+    cache_free(&trace_cache);
+}
+
+/*
+ * now - Wall-clock time in seconds
+ */
+double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * bench_parallel - Time the parallel transpose of an M x N matrix with
+ *     1, 2, 4, ... up to maxthreads threads, in the optimized build of
+ *     trans-native.o. Every thread count gets a fresh B, first touched
+ *     by the threads which write it, one warmup run and BENCH_REPS
+ *     timed runs. The bandwidth counts A read once
+ *     and B written once.
+ */
+void bench_parallel(int maxthreads)
+{
+    int (*a)[M] = malloc(sizeof(int) * M * N);
+    int (*b)[N];
+    int i, j, t, rep;
+    double start, secs, base = 0;
+    double bytes = 2.0 * sizeof(int) * M * N * BENCH_REPS;
+
+    assert(a);
+    for (i = 0; i < N; i++)
+        for (j = 0; j < M; j++)
+            a[i][j] = i * M + j;
+
+    printf("Parallel transpose of %dx%d (%.1f MB per matrix)\n",
+           M, N, sizeof(int) * M * N / 1e6);
+    for (t = 1; ; t = t * 2 < maxthreads ? t * 2 : maxthreads) {
+        b = malloc(sizeof(int) * M * N);
+        assert(b);
+        native_touch_parallel(M, N, b, t);
+        native_trans_parallel_n(M, N, a, b, t);
+
+        start = now();
+        for (rep = 0; rep < BENCH_REPS; rep++)
+            native_trans_parallel_n(M, N, a, b, t);
+        secs = now() - start;
+        if (t == 1)
+            base = secs;
+
+        printf("threads:%d, time:%.3f ms, bandwidth:%.2f GB/s, speedup:%.2f, correct:%d\n",
+               t, secs * 1e3 / BENCH_REPS, bytes / secs / 1e9, base / secs,
+               is_transpose(M, N, a, b));
+        free(b);
+        if (t == maxthreads)
+            break;
+    }
+    free(a);
+}
+
+/*
+ * fill_kernel - Fill the inputs of the kernels with small values, so
+ *     that sums of products do not overflow, and clear C
+ */
+void fill_kernel(int *a, int *b, int *c)
+{
+    int i;
+
+    for (i = 0; i < M * N; i++) {
+        a[i] = rand() % 16;
+        b[i] = rand() % 16;
+    }
+    for (i = 0; i < N * N; i++)
+        c[i] = 0;
+}
+
+/*
+ * eval_kernels - Evaluate the registered kernels of kernels.c on the
+ *     current shape: misses of a traced run on the cache model, then
+ *     the wall-clock time of its optimized build in kernels-native.o,
+ *     averaged over BENCH_REPS runs after one warmup.
+ */
+void eval_kernels(unsigned int s, unsigned int E, unsigned int b)
+{
+    int *pa = malloc(sizeof(int) * M * N);
+    int *pb = malloc(sizeof(int) * M * N);
+    int *pc = malloc(sizeof(int) * N * N);
+    kernel_func_t *k;
+    int i, rep;
+    double start;
+
+    assert(pa && pb && pc);
+    cache_init(&trace_cache, s, E, b);
+
+    printf("\nKernels on %dx%d (s=%d, E=%d, b=%d)\n", M, N, s, E, b);
+    for (i = 0; i < kernel_counter; i++) {
+        k = &kernel_list[i];
+        fill_kernel(pa, pb, pc);
+        cache_reset(&trace_cache);
+        setTraceHook(trace_to_cache);
+        k->func_ptr(M, N, pa, pb, pc);
+        setTraceHook(NULL);
+
+        k->correct = k->check(M, N, pa, pb, pc);
+        if (!k->correct) {
+            printf("kernel %d (%s): validation error\n", i, k->description);
+            continue;
         }
+        k->num_hits = trace_cache.hits;
+        k->num_misses = trace_cache.misses;
+        k->num_evictions = trace_cache.evictions;
+
+        native_kernels[i](M, N, pa, pb, pc);
+        start = now();
+        for (rep = 0; rep < BENCH_REPS; rep++)
+            native_kernels[i](M, N, pa, pb, pc);
+        k->seconds = (now() - start) / BENCH_REPS;
+
+        printf("kernel %d (%s): hits:%u, misses:%u, evictions:%u, time:%.3f ms\n",
+               i, k->description, k->num_hits, k->num_misses,
+               k->num_evictions, k->seconds * 1e3);
+    }
+    cache_free(&trace_cache);
+    free(pa);
+    free(pb);
+    free(pc);
+}
+
+/*
+ * perf_open - Open the hardware read miss counters of this thread. A
+ *     counter the kernel refuses (no PMU, perf_event_paranoid) stays
+ *     closed and is reported as n/a.
+ */
+void perf_open()
+{
+    static unsigned long long caches[PERF_COUNTERS] =
+        {PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_LL};
+    struct perf_event_attr attr;
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.size = sizeof(attr);
+        attr.config = caches[i] | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        perf_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (perf_fds[i] < 0)
+            printf("Warning: %s miss counter not available\n", perf_names[i]);
+    }
+}
+
+/*
+ * perf_start - Reset and start the open counters
+ */
+void perf_start()
+{
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (perf_fds[i] >= 0) {
+            ioctl(perf_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/*
+ * perf_stop - Stop the open counters and read them into counts, -1 for
+ *     those not open
+ */
+void perf_stop(long long *counts)
+{
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        counts[i] = -1;
+        if (perf_fds[i] >= 0) {
+            ioctl(perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(perf_fds[i], &counts[i], sizeof(long long)) != sizeof(long long))
+                counts[i] = -1;
+        }
+    }
+}
+
+/*
+ * rank - Position of values[i] among the values of the correct
+ *     functions, 1 being the smallest
+ */
+int rank(double *values, int i)
+{
+    int j, r = 1;
+
+    for (j = 0; j < func_counter; j++)
+        if (func_list[j].correct && values[j] < values[i])
+            r++;
+    return r;
+}
+
+/*
+ * bench_funcs - Evaluate every registered transpose function on the
+ *     current shape both ways: misses of a traced run on the cache
+ *     model, and native time per run of its optimized build in
+ *     trans-native.o, over enough repetitions to add up to BENCH_REPS
+ *     runs on MAXN x MAXN, after one warmup run. Both
+ *     rankings are printed side by side, with the hardware miss
+ *     counts per run when -e opened the counters.
+ */
+void bench_funcs(unsigned int s, unsigned int E, unsigned int b)
+{
+    double misses[MAX_TRANS_FUNCS], secs[MAX_TRANS_FUNCS];
+    long long counts[MAX_TRANS_FUNCS][PERF_COUNTERS];
+    int reps = BENCH_REPS * (MAXN * MAXN) / (M * N);
+    int i, j, rep;
+    double start;
+
+    cache_init(&trace_cache, s, E, b);
+    for (i = 0; i < func_counter; i++) {
+        initMatrix(M, N, A, B);
+        cache_reset(&trace_cache);
+        setTraceHook(trace_to_cache);
+        (*func_list[i].func_ptr)(M, N, A, B);
+        setTraceHook(NULL);
+        func_list[i].correct = is_transpose(M, N, A, B);
+        func_list[i].num_hits = trace_cache.hits;
+        func_list[i].num_misses = trace_cache.misses;
+        func_list[i].num_evictions = trace_cache.evictions;
+        misses[i] = trace_cache.misses;
+
+        (*native_funcs[i])(M, N, A, B);
+        perf_start();
+        start = now();
+        for (rep = 0; rep < reps; rep++)
+            (*native_funcs[i])(M, N, A, B);
+        secs[i] = (now() - start) / reps;
+        perf_stop(counts[i]);
+    }
+    cache_free(&trace_cache);
+
+    printf("\nBenchmark of %dx%d (%d runs after 1 warmup, s=%d, E=%d, b=%d)\n",
+           M, N, reps, s, E, b);
+    for (i = 0; i < func_counter; i++) {
+        if (!func_list[i].correct) {
+            printf("func %d (%s): validation error\n", i, func_list[i].description);
+            continue;
+        }
+        printf("func %d (%s): misses:%u (#%d), time:%.3f us (#%d)",
+               i, func_list[i].description, func_list[i].num_misses,
+               rank(misses, i), secs[i] * 1e6, rank(secs, i));
+        for (j = 0; j < PERF_COUNTERS; j++) {
+            if (perf_fds[j] < 0)
+                continue;
+            if (counts[i][j] < 0)
+                printf(", %s:n/a", perf_names[j]);
+            else
+                printf(", %s:%.1f", perf_names[j], (double)counts[i][j] / reps);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * sweep - Run the kernels (-k) or the benchmark (-b) on -M x -N, or on
+ *     every shape of sweep_shapes if no shape was given
+ */
+void sweep(int kernels)
+{
+    int i, n = M == 0 ? sizeof(sweep_shapes) / sizeof(sweep_shapes[0]) : 1;
+
+    if (kernels) {
+        registerKernels();
+        native_registerKernels();
+        assert(native_kernel_counter == kernel_counter);
+    }
+    else {
+        registerFunctions();
+        native_registerFunctions();
+        assert(native_func_counter == func_counter);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (n > 1) {
+            M = sweep_shapes[i][0];
+            N = sweep_shapes[i][1];
+        }
+        if (kernels)
+            eval_kernels(5, 1, 5);
+        else
+            bench_funcs(5, 1, 5);
     }
-  
 }
 
 /*
  * usage - Print usage info
  */
 void usage(char *argv[]){
-    printf("Usage: %s [-h] -M <rows> -N <cols>\n", argv[0]);
+    printf("Usage: %s [-hikbe] [-p <threads>] -M <rows> -N <cols>\n", argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
+    printf("  -i          Trace in process instead of with valgrind.\n");
+    printf("  -k          Evaluate the kernels of kernels.c instead, on every\n");
+    printf("              default shape if -M and -N are not given.\n");
+    printf("  -b          Rank the functions by simulated misses and by native\n");
+    printf("              time, on every default shape if -M and -N are not given.\n");
+    printf("  -e          With -b, also count L1D and LLC read misses with\n");
+    printf("              perf_event_open.\n");
+    printf("  -p <n>      Benchmark the parallel transpose on up to n threads,\n");
+    printf("              M and N are not limited.\n");
     printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of  matrix columns (max %d)\n", MAXN);
     printf("Example: %s -M 8 -N 8\n", argv[0]);       
@@ -198,8 +633,9 @@ void sigalrm_handler(int signum){
 int main(int argc, char* argv[])
 {
     char c;
+    int inproc = 0, maxthreads = 0, kernels = 0, bench = 0;
 
-    while ((c = getopt(argc,argv,"M:N:h")) != -1) {
+    while ((c = getopt(argc,argv,"M:N:hikbep:")) != -1) {
         switch(c) {
         case 'M':
             M = atoi(optarg);
@@ -207,6 +643,21 @@ int main(int argc, char* argv[])
         case 'N':
             N = atoi(optarg);
             break;
+        case 'i':
+            inproc = 1;
+            break;
+        case 'k':
+            kernels = 1;
+            break;
+        case 'b':
+            bench = 1;
+            break;
+        case 'e':
+            perf_open();
+            break;
+        case 'p':
+            maxthreads = atoi(optarg);
+            break;
         case 'h':
             usage(argv);
             exit(0);
@@ -216,18 +667,33 @@ int main(int argc, char* argv[])
         }
     }
   
+    if ((kernels || bench) && M == 0 && N == 0) {
+        sweep(kernels);
+        return 0;
+    }
+
     if (M == 0 || N == 0) {
         printf("Error: Missing required argument\n");
         usage(argv);
         exit(1);
     }
 
+    if (maxthreads > 0) {
+        bench_parallel(maxthreads);
+        return 0;
+    }
+
     if (M > MAXN || N > MAXN) {
         printf("Error: M or N exceeds %d\n", MAXN);
         usage(argv);
         exit(1);
     }
 
+    if (kernels || bench) {
+        sweep(kernels);
+        return 0;
+    }
+
     /* Install SIGSEGV and SIGALRM handlers */
     if (signal(SIGSEGV, sigsegv_handler) == SIG_ERR) {
         fprintf(stderr, "Unable to install SIGALRM handler\n");
@@ -243,7 +709,10 @@ int main(int argc, char* argv[])
     alarm(120);
 
     /* Check the performance of the student's transpose function */
-    eval_perf(5, 1, 5);
+    if (inproc)
+        eval_perf_inproc(5, 1, 5);
+    else
+        eval_perf(5, 1, 5);
   
     /* Emit the results for this particular test */
     if (results.funcid == -1) {
@@ -6,11 +6,36 @@
  *
  * A transpose function is evaluated by counting the number of misses
  * on a 1KB direct mapped cache with a block size of 32 bytes.
+ *
+ * Read A and B through LOAD() and write them through STORE() (see
+ * cachelab.h), so that test-trans -i can trace the function in
+ * process. Without -DTRACE_TRANS they are plain accesses.
  */ 
+#include <assert.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "cachelab.h"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+void trans_oblivious(int M, int N, int A[N][M], int B[M][N]);
+
+/* Side of the base-case tile of the cache-oblivious transposes. A
+ * row of 8 ints fills a 32-byte block, so the recursion stops at
+ * one block per row of the tile.
+ */
+#define CO_TILE 8
+
+/* Bytes covered by the sets of the 1KB cache, 32 sets of 32-byte
+ * blocks: addresses a multiple of this apart share a set. When the
+ * rows of a matrix come back to the same sets less than CO_TILE rows
+ * apart, as every 4 rows at 64 ints a row or every row at 256, an 8x8
+ * tile thrashes, and its leaves are worked differently.
+ */
+#define CO_SPAN 1024
 
 /* 
  * transpose_submit - This is the solution transpose function that you
@@ -30,22 +55,22 @@ void transpose_submit(int M, int N, int A[N][M], int B[M][N])
 		for (i = 0; i < 32; i += 8) {
 			for (j = 0; j < 32; j += 8) {
 				for (k = 0; k < 8; k++) {
-					tmp0 = A[i+k][j];
-					tmp1 = A[i+k][j+1];
-					tmp2 = A[i+k][j+2];
-					tmp3 = A[i+k][j+3];
-					tmp4 = A[i+k][j+4];
-					tmp5 = A[i+k][j+5];
-					tmp6 = A[i+k][j+6];
-					tmp7 = A[i+k][j+7];
-					B[j][i+k] = tmp0;
-					B[j+1][i+k] = tmp1;
-					B[j+2][i+k] = tmp2;
-					B[j+3][i+k] = tmp3;
-					B[j+4][i+k] = tmp4;
-					B[j+5][i+k] = tmp5;
-					B[j+6][i+k] = tmp6;
-					B[j+7][i+k] = tmp7;
+					tmp0 = LOAD(A[i+k][j]);
+					tmp1 = LOAD(A[i+k][j+1]);
+					tmp2 = LOAD(A[i+k][j+2]);
+					tmp3 = LOAD(A[i+k][j+3]);
+					tmp4 = LOAD(A[i+k][j+4]);
+					tmp5 = LOAD(A[i+k][j+5]);
+					tmp6 = LOAD(A[i+k][j+6]);
+					tmp7 = LOAD(A[i+k][j+7]);
+					STORE(B[j][i+k], tmp0);
+					STORE(B[j+1][i+k], tmp1);
+					STORE(B[j+2][i+k], tmp2);
+					STORE(B[j+3][i+k], tmp3);
+					STORE(B[j+4][i+k], tmp4);
+					STORE(B[j+5][i+k], tmp5);
+					STORE(B[j+6][i+k], tmp6);
+					STORE(B[j+7][i+k], tmp7);
 				}
 			}
 		}
@@ -55,36 +80,36 @@ void transpose_submit(int M, int N, int A[N][M], int B[M][N])
 		for (j = 0; j < 56; j += 8) {
 			// At first manage 56 columns
 			for (i = 0; i < 67; i++) {
-				tmp0 = A[i][j];
-				tmp1 = A[i][j+1];
-				tmp2 = A[i][j+2];
-				tmp3 = A[i][j+3];
-				tmp4 = A[i][j+4];
-				tmp5 = A[i][j+5];
-				tmp6 = A[i][j+6];
-				tmp7 = A[i][j+7];
-				B[j][i] = tmp0;
-				B[j+1][i] = tmp1;		
-				B[j+2][i] = tmp2;		
-				B[j+3][i] = tmp3;		
-				B[j+4][i] = tmp4;		
-				B[j+5][i] = tmp5;		
-				B[j+6][i] = tmp6;		
-				B[j+7][i] = tmp7;
+				tmp0 = LOAD(A[i][j]);
+				tmp1 = LOAD(A[i][j+1]);
+				tmp2 = LOAD(A[i][j+2]);
+				tmp3 = LOAD(A[i][j+3]);
+				tmp4 = LOAD(A[i][j+4]);
+				tmp5 = LOAD(A[i][j+5]);
+				tmp6 = LOAD(A[i][j+6]);
+				tmp7 = LOAD(A[i][j+7]);
+				STORE(B[j][i], tmp0);
+				STORE(B[j+1][i], tmp1);		
+				STORE(B[j+2][i], tmp2);		
+				STORE(B[j+3][i], tmp3);		
+				STORE(B[j+4][i], tmp4);		
+				STORE(B[j+5][i], tmp5);		
+				STORE(B[j+6][i], tmp6);		
+				STORE(B[j+7][i], tmp7);
 			}
 		}
 		for (i = 0; i < 67; i++) {
 			//Manage the last five columns
-			tmp0 = A[i][56];
-			tmp1 = A[i][57];
-			tmp2 = A[i][58];
-			tmp3 = A[i][59];
-			tmp4 = A[i][60];
-			B[56][i] = tmp0;
-			B[57][i] = tmp1;
-			B[58][i] = tmp2;
-			B[59][i] = tmp3;
-			B[60][i] = tmp4;
+			tmp0 = LOAD(A[i][56]);
+			tmp1 = LOAD(A[i][57]);
+			tmp2 = LOAD(A[i][58]);
+			tmp3 = LOAD(A[i][59]);
+			tmp4 = LOAD(A[i][60]);
+			STORE(B[56][i], tmp0);
+			STORE(B[57][i], tmp1);
+			STORE(B[58][i], tmp2);
+			STORE(B[59][i], tmp3);
+			STORE(B[60][i], tmp4);
 		}
 	}
 
@@ -105,24 +130,24 @@ void transpose_submit(int M, int N, int A[N][M], int B[M][N])
 					 *
 					 */
 					for (k = 0; k < 4; k++) {
-						tmp0 = A[i+k][j];
-						tmp1 = A[i+k][j+1];
-						tmp2 = A[i+k][j+2];
-						tmp3 = A[i+k][j+3];
-						tmp4 = A[i+k][j+4];
-						tmp5 = A[i+k][j+5];
-						tmp6 = A[i+k][j+6];
-						tmp7 = A[i+k][j+7];
+						tmp0 = LOAD(A[i+k][j]);
+						tmp1 = LOAD(A[i+k][j+1]);
+						tmp2 = LOAD(A[i+k][j+2]);
+						tmp3 = LOAD(A[i+k][j+3]);
+						tmp4 = LOAD(A[i+k][j+4]);
+						tmp5 = LOAD(A[i+k][j+5]);
+						tmp6 = LOAD(A[i+k][j+6]);
+						tmp7 = LOAD(A[i+k][j+7]);
 						
-						B[j][i+k] = tmp0;
-						B[j+1][i+k] = tmp1;
-						B[j+2][i+k] = tmp2;
-						B[j+3][i+k] = tmp3;
-
-						B[j][i+k+4] = tmp4;
-						B[j+1][i+k+4] = tmp5;
-						B[j+2][i+k+4] = tmp6;
-						B[j+3][i+k+4] = tmp7;
+						STORE(B[j][i+k], tmp0);
+						STORE(B[j+1][i+k], tmp1);
+						STORE(B[j+2][i+k], tmp2);
+						STORE(B[j+3][i+k], tmp3);
+
+						STORE(B[j][i+k+4], tmp4);
+						STORE(B[j+1][i+k+4], tmp5);
+						STORE(B[j+2][i+k+4], tmp6);
+						STORE(B[j+3][i+k+4], tmp7);
 					}
 				}
 				else {
@@ -134,25 +159,25 @@ void transpose_submit(int M, int N, int A[N][M], int B[M][N])
 						 *  A12   ***
 						 *
 						 */
-						tmp0 = B[j+k][i];
-						tmp1 = B[j+k][i+1];
-						tmp2 = B[j+k][i+2];
-						tmp3 = B[j+k][i+3];
+						tmp0 = LOAD(B[j+k][i]);
+						tmp1 = LOAD(B[j+k][i+1]);
+						tmp2 = LOAD(B[j+k][i+2]);
+						tmp3 = LOAD(B[j+k][i+3]);
 						
-						tmp4 = A[i][j+k];
-						tmp5 = A[i+1][j+k];
-						tmp6 = A[i+2][j+k];
-						tmp7 = A[i+3][j+k];
-
-						B[j+k][i] = tmp4;
-						B[j+k][i+1] = tmp5;
-						B[j+k][i+2] = tmp6;
-						B[j+k][i+3] = tmp7;
-
-						B[j+k+4][i-4] = tmp0;
-						B[j+k+4][i-3] = tmp1;
-						B[j+k+4][i-2] = tmp2;
-						B[j+k+4][i-1] = tmp3;
+						tmp4 = LOAD(A[i][j+k]);
+						tmp5 = LOAD(A[i+1][j+k]);
+						tmp6 = LOAD(A[i+2][j+k]);
+						tmp7 = LOAD(A[i+3][j+k]);
+
+						STORE(B[j+k][i], tmp4);
+						STORE(B[j+k][i+1], tmp5);
+						STORE(B[j+k][i+2], tmp6);
+						STORE(B[j+k][i+3], tmp7);
+
+						STORE(B[j+k+4][i-4], tmp0);
+						STORE(B[j+k+4][i-3], tmp1);
+						STORE(B[j+k+4][i-2], tmp2);
+						STORE(B[j+k+4][i-1], tmp3);
 					}
 					for (k = 0; k < 4; k++) {
 						/* change B into:
@@ -162,15 +187,15 @@ void transpose_submit(int M, int N, int A[N][M], int B[M][N])
 						 * A12  A22
 						 *
 						 */
-						tmp0 = A[i+k][j+4];
-						tmp1 = A[i+k][j+5];
-						tmp2 = A[i+k][j+6];
-						tmp3 = A[i+k][j+7];
-
-						B[j+4][i+k] = tmp0;
-						B[j+5][i+k] = tmp1;
-						B[j+6][i+k] = tmp2;
-						B[j+7][i+k] = tmp3;
+						tmp0 = LOAD(A[i+k][j+4]);
+						tmp1 = LOAD(A[i+k][j+5]);
+						tmp2 = LOAD(A[i+k][j+6]);
+						tmp3 = LOAD(A[i+k][j+7]);
+
+						STORE(B[j+4][i+k], tmp0);
+						STORE(B[j+5][i+k], tmp1);
+						STORE(B[j+6][i+k], tmp2);
+						STORE(B[j+7][i+k], tmp3);
 					}
 				}
 			}
@@ -178,10 +203,8 @@ void transpose_submit(int M, int N, int A[N][M], int B[M][N])
 	}
 
 	else {
-		int i, j;
-		for (i = 0; i < N; i++) 
-			for (j = 0; j < M; j++)
-				A[i][j] = B[j][i];
+		/* Any other shape goes to the cache-oblivious transpose */
+		trans_oblivious(M, N, A, B);
 	}
 	
 }
@@ -201,13 +224,730 @@ void trans(int M, int N, int A[N][M], int B[M][N])
 
     for (i = 0; i < N; i++) {
         for (j = 0; j < M; j++) {
-            tmp = A[i][j];
-            B[j][i] = tmp;
+            tmp = LOAD(A[i][j]);
+            STORE(B[j][i], tmp);
         }
     }    
 
 }
 
+/*
+ * co_split - Return where to cut [lo, hi) in two halves, rounded to
+ *     a multiple of the tile side so that the tiles stay aligned to
+ *     blocks.
+ */
+int co_split(int lo, int hi, int tile)
+{
+	int tiles = (hi - lo + tile - 1) / tile;
+
+	return lo + (tiles / 2) * tile;
+}
+
+/*
+ * co_period - Return after how many rows of stride ints the rows come
+ *     back to the same sets of the cache, CO_SPAN over the gcd of
+ *     CO_SPAN and the bytes of a row.
+ */
+int co_period(int stride)
+{
+	int a = CO_SPAN, b = stride * (int)sizeof(int), t;
+
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return CO_SPAN / a;
+}
+
+/*
+ * trans_tile_split - Transpose the full 8x8 tile at A[r0][c0] of a
+ *     matrix whose rows alias every 4 rows, four rows at a time like
+ *     the 64x64 case of transpose_submit: the top half of A goes to the top of
+ *     the tile of B, its right quarter parked in the top right, which
+ *     then moves down as the bottom left of A takes its place.
+ */
+void trans_tile_split(int M, int N, int A[N][M], int B[M][N], int r0, int c0)
+{
+	int k, tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+
+	for (k = 0; k < 4; k++) {
+		tmp0 = LOAD(A[r0+k][c0]);
+		tmp1 = LOAD(A[r0+k][c0+1]);
+		tmp2 = LOAD(A[r0+k][c0+2]);
+		tmp3 = LOAD(A[r0+k][c0+3]);
+		tmp4 = LOAD(A[r0+k][c0+4]);
+		tmp5 = LOAD(A[r0+k][c0+5]);
+		tmp6 = LOAD(A[r0+k][c0+6]);
+		tmp7 = LOAD(A[r0+k][c0+7]);
+		STORE(B[c0][r0+k], tmp0);
+		STORE(B[c0+1][r0+k], tmp1);
+		STORE(B[c0+2][r0+k], tmp2);
+		STORE(B[c0+3][r0+k], tmp3);
+		STORE(B[c0][r0+k+4], tmp4);
+		STORE(B[c0+1][r0+k+4], tmp5);
+		STORE(B[c0+2][r0+k+4], tmp6);
+		STORE(B[c0+3][r0+k+4], tmp7);
+	}
+	for (k = 0; k < 4; k++) {
+		tmp0 = LOAD(B[c0+k][r0+4]);
+		tmp1 = LOAD(B[c0+k][r0+5]);
+		tmp2 = LOAD(B[c0+k][r0+6]);
+		tmp3 = LOAD(B[c0+k][r0+7]);
+		tmp4 = LOAD(A[r0+4][c0+k]);
+		tmp5 = LOAD(A[r0+5][c0+k]);
+		tmp6 = LOAD(A[r0+6][c0+k]);
+		tmp7 = LOAD(A[r0+7][c0+k]);
+		STORE(B[c0+k][r0+4], tmp4);
+		STORE(B[c0+k][r0+5], tmp5);
+		STORE(B[c0+k][r0+6], tmp6);
+		STORE(B[c0+k][r0+7], tmp7);
+		STORE(B[c0+k+4][r0], tmp0);
+		STORE(B[c0+k+4][r0+1], tmp1);
+		STORE(B[c0+k+4][r0+2], tmp2);
+		STORE(B[c0+k+4][r0+3], tmp3);
+	}
+	for (k = 4; k < 8; k++) {
+		tmp0 = LOAD(A[r0+k][c0+4]);
+		tmp1 = LOAD(A[r0+k][c0+5]);
+		tmp2 = LOAD(A[r0+k][c0+6]);
+		tmp3 = LOAD(A[r0+k][c0+7]);
+		STORE(B[c0+4][r0+k], tmp0);
+		STORE(B[c0+5][r0+k], tmp1);
+		STORE(B[c0+6][r0+k], tmp2);
+		STORE(B[c0+7][r0+k], tmp3);
+	}
+}
+
+/*
+ * trans_tile_buf - Transpose the full 8x8 tile at A[r0][c0] through a
+ *     local copy, for rows aliasing less than 4 apart, where even half
+ *     a tile of B does not stay in the cache. Every row of the tile of
+ *     A is read whole, then every row of the tile of B written whole,
+ *     so each block is brought in once however the rows collide.
+ */
+void trans_tile_buf(int M, int N, int A[N][M], int B[M][N], int r0, int c0)
+{
+	int i, j;
+	int tile[CO_TILE][CO_TILE];
+
+	for (i = 0; i < CO_TILE; i++)
+		for (j = 0; j < CO_TILE; j++)
+			tile[j][i] = LOAD(A[r0+i][c0+j]);
+	for (j = 0; j < CO_TILE; j++)
+		for (i = 0; i < CO_TILE; i++)
+			STORE(B[c0+j][r0+i], tile[j][i]);
+}
+
+/*
+ * trans_tile - Transpose the tile A[r0..r1)[c0..c1) into B. A full
+ *     row of the tile is read into registers before it is written to
+ *     B, so that A and B do not evict each other on the diagonal. A
+ *     full tile of a matrix whose rows alias within a tile goes to
+ *     trans_tile_split or trans_tile_buf instead.
+ */
+void trans_tile(int M, int N, int A[N][M], int B[M][N],
+		int r0, int r1, int c0, int c1)
+{
+	int i, j, period, tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+
+	if (r1 - r0 == CO_TILE && c1 - c0 == CO_TILE) {
+		period = co_period(M) < co_period(N) ? co_period(M) : co_period(N);
+		if (period < CO_TILE / 2) {
+			trans_tile_buf(M, N, A, B, r0, c0);
+			return;
+		}
+		if (period < CO_TILE) {
+			trans_tile_split(M, N, A, B, r0, c0);
+			return;
+		}
+	}
+	for (i = r0; i < r1; i++) {
+		if (c1 - c0 == CO_TILE) {
+			tmp0 = LOAD(A[i][c0]);
+			tmp1 = LOAD(A[i][c0+1]);
+			tmp2 = LOAD(A[i][c0+2]);
+			tmp3 = LOAD(A[i][c0+3]);
+			tmp4 = LOAD(A[i][c0+4]);
+			tmp5 = LOAD(A[i][c0+5]);
+			tmp6 = LOAD(A[i][c0+6]);
+			tmp7 = LOAD(A[i][c0+7]);
+			STORE(B[c0][i], tmp0);
+			STORE(B[c0+1][i], tmp1);
+			STORE(B[c0+2][i], tmp2);
+			STORE(B[c0+3][i], tmp3);
+			STORE(B[c0+4][i], tmp4);
+			STORE(B[c0+5][i], tmp5);
+			STORE(B[c0+6][i], tmp6);
+			STORE(B[c0+7][i], tmp7);
+		}
+		else {
+			for (j = c0; j < c1; j++)
+				STORE(B[j][i], LOAD(A[i][j]));
+		}
+	}
+}
+
+/*
+ * trans_rec - Transpose A[r0..r1)[c0..c1) into B by halving the
+ *     longer side until the sub-matrix fits in one tile.
+ */
+void trans_rec(int M, int N, int A[N][M], int B[M][N],
+		int r0, int r1, int c0, int c1)
+{
+	int mid;
+
+	if (r1 - r0 <= CO_TILE && c1 - c0 <= CO_TILE) {
+		trans_tile(M, N, A, B, r0, r1, c0, c1);
+	}
+	else if (r1 - r0 >= c1 - c0) {
+		mid = co_split(r0, r1, CO_TILE);
+		trans_rec(M, N, A, B, r0, mid, c0, c1);
+		trans_rec(M, N, A, B, mid, r1, c0, c1);
+	}
+	else {
+		mid = co_split(c0, c1, CO_TILE);
+		trans_rec(M, N, A, B, r0, r1, c0, mid);
+		trans_rec(M, N, A, B, r0, r1, mid, c1);
+	}
+}
+
+/*
+ * trans_oblivious - Cache-oblivious transpose of any M x N matrix, the
+ *     leaves worked according to how far apart its rows alias.
+ */
+char trans_oblivious_desc[] = "Cache-oblivious recursive transpose";
+void trans_oblivious(int M, int N, int A[N][M], int B[M][N])
+{
+	trans_rec(M, N, A, B, 0, N, 0, M);
+}
+
+/*
+ * swap_tiles_buf - Swap the full 8x8 tile at A[r0][c0] with the
+ *     transpose of its mirror through local copies of both, for rows
+ *     aliasing less than 4 apart: every row of the two tiles is read
+ *     whole, then written back whole.
+ */
+void swap_tiles_buf(int N, int A[N][N], int r0, int c0)
+{
+	int i, k;
+	int tile[CO_TILE][CO_TILE], mirror[CO_TILE][CO_TILE];
+
+	for (i = 0; i < CO_TILE; i++)
+		for (k = 0; k < CO_TILE; k++)
+			tile[i][k] = LOAD(A[r0+i][c0+k]);
+	for (k = 0; k < CO_TILE; k++)
+		for (i = 0; i < CO_TILE; i++)
+			mirror[k][i] = LOAD(A[c0+k][r0+i]);
+	for (i = 0; i < CO_TILE; i++)
+		for (k = 0; k < CO_TILE; k++)
+			STORE(A[r0+i][c0+k], mirror[k][i]);
+	for (k = 0; k < CO_TILE; k++)
+		for (i = 0; i < CO_TILE; i++)
+			STORE(A[c0+k][r0+i], tile[i][k]);
+}
+
+/*
+ * swap_tiles - Swap the tile A[r0..r1)[c0..c1) with the transpose of
+ *     its mirror A[c0..c1)[r0..r1) on the other side of the diagonal.
+ *     Each row of the tile is read into registers, exchanged with the
+ *     matching column of the mirror, then written back whole, so the
+ *     row is fetched once instead of once per element. Full tiles of
+ *     a matrix whose rows alias less than 4 apart go to
+ *     swap_tiles_buf.
+ */
+void swap_tiles(int N, int A[N][N], int r0, int r1, int c0, int c1)
+{
+	int i, k, n = c1 - c0, tmp;
+	int row[CO_TILE];
+
+	if (r1 - r0 == CO_TILE && n == CO_TILE && co_period(N) < CO_TILE / 2) {
+		swap_tiles_buf(N, A, r0, c0);
+		return;
+	}
+	for (i = r0; i < r1; i++) {
+		for (k = 0; k < n; k++)
+			row[k] = LOAD(A[i][c0+k]);
+		for (k = 0; k < n; k++) {
+			tmp = LOAD(A[c0+k][i]);
+			STORE(A[c0+k][i], row[k]);
+			row[k] = tmp;
+		}
+		for (k = 0; k < n; k++)
+			STORE(A[i][c0+k], row[k]);
+	}
+}
+
+/*
+ * swap_rec - Swap A[r0..r1)[c0..c1) with the transpose of its mirror
+ *     A[c0..c1)[r0..r1), the two blocks lying on either side of the
+ *     diagonal, a pair of tiles of the given side at a time.
+ */
+void swap_rec(int N, int A[N][N], int r0, int r1, int c0, int c1, int tile)
+{
+	int mid;
+
+	if (r1 - r0 <= tile && c1 - c0 <= tile) {
+		swap_tiles(N, A, r0, r1, c0, c1);
+	}
+	else if (r1 - r0 >= c1 - c0) {
+		mid = co_split(r0, r1, tile);
+		swap_rec(N, A, r0, mid, c0, c1, tile);
+		swap_rec(N, A, mid, r1, c0, c1, tile);
+	}
+	else {
+		mid = co_split(c0, c1, tile);
+		swap_rec(N, A, r0, r1, c0, mid, tile);
+		swap_rec(N, A, r0, r1, mid, c1, tile);
+	}
+}
+
+/*
+ * inplace_rec - Transpose the square A[lo..hi)[lo..hi) on the diagonal
+ *     in place: transpose both diagonal halves, then swap the two
+ *     off-diagonal quarters. A full diagonal tile of a matrix whose
+ *     rows alias less than 4 apart is transposed through a local copy.
+ */
+void inplace_rec(int N, int A[N][N], int lo, int hi, int tile)
+{
+	int i, j, mid, tmp;
+	int copy[CO_TILE][CO_TILE];
+
+	if (hi - lo == CO_TILE && co_period(N) < CO_TILE / 2) {
+		for (i = 0; i < CO_TILE; i++)
+			for (j = 0; j < CO_TILE; j++)
+				copy[j][i] = LOAD(A[lo+i][lo+j]);
+		for (i = 0; i < CO_TILE; i++)
+			for (j = 0; j < CO_TILE; j++)
+				STORE(A[lo+i][lo+j], copy[i][j]);
+		return;
+	}
+	if (hi - lo <= tile) {
+		for (i = lo; i < hi; i++) {
+			for (j = i + 1; j < hi; j++) {
+				tmp = LOAD(A[i][j]);
+				STORE(A[i][j], LOAD(A[j][i]));
+				STORE(A[j][i], tmp);
+			}
+		}
+		return;
+	}
+
+	mid = co_split(lo, hi, tile);
+	inplace_rec(N, A, lo, mid, tile);
+	inplace_rec(N, A, mid, hi, tile);
+	swap_rec(N, A, lo, mid, mid, hi, tile);
+}
+
+/*
+ * trans_inplace - Cache-oblivious in-place transpose of a square
+ *     matrix. The driver checks B, so A is first copied into B, a
+ *     block of each row at a time through registers: A and B share
+ *     the sets of the cache, and an element by element copy would
+ *     have each store evict the block just read. Other shapes use
+ *     trans_oblivious.
+ */
+char trans_inplace_desc[] = "Cache-oblivious in-place transpose (square)";
+void trans_inplace(int M, int N, int A[N][M], int B[M][N])
+{
+	int i, j, k, n, period = co_period(N);
+	int row[CO_TILE];
+
+	if (M != N) {
+		trans_oblivious(M, N, A, B);
+		return;
+	}
+
+	for (i = 0; i < N; i++) {
+		for (j = 0; j < M; j += CO_TILE) {
+			n = M - j < CO_TILE ? M - j : CO_TILE;
+			for (k = 0; k < n; k++)
+				row[k] = LOAD(A[i][j+k]);
+			for (k = 0; k < n; k++)
+				STORE(B[i][j+k], row[k]);
+		}
+	}
+	/* 4x4 tiles keep clear of rows aliasing 4 apart; when they alias
+	   closer, 8x8 tiles go through local copies */
+	inplace_rec(N, B, 0, N, period < CO_TILE && period >= CO_TILE / 2 ?
+			CO_TILE / 2 : CO_TILE);
+}
+
+/*
+ * trans_param - Blocked transpose shaped by cfg, the search space of
+ *     autotune. A is cut into tile_rows x tile_cols tiles. Inside a
+ *     tile, groups of depth elements along a row (or a column with
+ *     TUNE_WALK_COLS) of A are loaded into registers before they are
+ *     stored into B. With diag set, the element on the diagonal is
+ *     stored last, after the rest of its group. cfg is read once into
+ *     locals: under valgrind every read of it in the loops would be a
+ *     traced access, which the model autotune searched with does not
+ *     see.
+ */
+void trans_param(int M, int N, int A[N][M], int B[M][N], tune_t *cfg)
+{
+	int tile_rows = cfg->tile_rows, tile_cols = cfg->tile_cols;
+	int order = cfg->order, diag = cfg->diag, depth = cfg->depth;
+	int r0, c0, r1, c1, i, j, k, n, skip, rows, cols, t;
+	int buf[TUNE_MAX_DEPTH];
+
+	assert(tile_rows > 0 && tile_cols > 0);
+	assert(depth >= 1 && depth <= TUNE_MAX_DEPTH);
+	rows = (N + tile_rows - 1) / tile_rows;
+	cols = (M + tile_cols - 1) / tile_cols;
+
+	for (t = 0; t < rows * cols; t++) {
+		if (order & TUNE_TILES_BY_COL) {
+			r0 = (t % rows) * tile_rows;
+			c0 = (t / rows) * tile_cols;
+		}
+		else {
+			r0 = (t / cols) * tile_rows;
+			c0 = (t % cols) * tile_cols;
+		}
+		r1 = r0 + tile_rows < N ? r0 + tile_rows : N;
+		c1 = c0 + tile_cols < M ? c0 + tile_cols : M;
+
+		if (!(order & TUNE_WALK_COLS)) {
+			for (i = r0; i < r1; i++) {
+				for (j = c0; j < c1; j += depth) {
+					n = c1 - j < depth ? c1 - j : depth;
+					for (k = 0; k < n; k++)
+						buf[k] = LOAD(A[i][j+k]);
+					skip = diag && i >= j && i < j + n ? i - j : -1;
+					for (k = 0; k < n; k++)
+						if (k != skip)
+							STORE(B[j+k][i], buf[k]);
+					if (skip != -1)
+						STORE(B[i][i], buf[skip]);
+				}
+			}
+		}
+		else {
+			for (j = c0; j < c1; j++) {
+				for (i = r0; i < r1; i += depth) {
+					n = r1 - i < depth ? r1 - i : depth;
+					for (k = 0; k < n; k++)
+						buf[k] = LOAD(A[i+k][j]);
+					skip = diag && j >= i && j < i + n ? j - i : -1;
+					for (k = 0; k < n; k++)
+						if (k != skip)
+							STORE(B[j][i+k], buf[k]);
+					if (skip != -1)
+						STORE(B[j][j], buf[skip]);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * trans_tuned - Blocked transpose with the configuration autotune saved
+ *     for this shape, or plain 8x8 tiles if it has none.
+ */
+char trans_tuned_desc[] = "Autotuned blocked transpose";
+void trans_tuned(int M, int N, int A[N][M], int B[M][N])
+{
+	static tune_t fallback = {0, 0, 8, 8, 0, 1, 8, 5, 1, 5, 0};
+	tune_t *cfg = findTuning(M, N);
+
+	trans_param(M, N, A, B, cfg != NULL ? cfg : &fallback);
+}
+
+/*
+ * The parallel transpose hands each thread of a pool one band of rows
+ * of B, that is one band of columns of A, cut on CO_TILE boundaries.
+ * Every thread writes only its own rows of B, so when the same threads
+ * first touch B (touch_parallel) its pages end up on their nodes.
+ */
+#define PAR_MAX_THREADS 64
+#define PAR_MIN_ELEMS (128 * 128)
+#define PAR_TOUCH 0
+#define PAR_TRANS 1
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	int started;	/* Helper threads created so far */
+	int generation;	/* Bumped for every job */
+	int pending;	/* Helpers still working on the job */
+	int nthreads;	/* Threads taking part in the job, caller included */
+	int kind;	/* PAR_TOUCH or PAR_TRANS */
+	int M, N;
+	int *A, *B;
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	  PTHREAD_COND_INITIALIZER};
+
+/*
+ * run_band - Do the part of the current job owned by thread id
+ */
+static void run_band(int id)
+{
+	int M = pool.M, N = pool.N;
+	int (*A)[M] = (int (*)[M])pool.A;
+	int (*B)[N] = (int (*)[N])pool.B;
+	int tiles = (M + CO_TILE - 1) / CO_TILE;
+	int j0 = tiles * id / pool.nthreads * CO_TILE;
+	int j1 = tiles * (id + 1) / pool.nthreads * CO_TILE;
+	int i, j;
+
+	if (j1 > M)
+		j1 = M;
+
+	if (pool.kind == PAR_TOUCH) {
+		for (j = j0; j < j1; j++)
+			for (i = 0; i < N; i++)
+				B[j][i] = 0;
+		return;
+	}
+
+	for (j = j0; j < j1; j += CO_TILE)
+		for (i = 0; i < N; i += CO_TILE)
+			trans_tile(M, N, A, B, i, i + CO_TILE < N ? i + CO_TILE : N,
+					j, j + CO_TILE < j1 ? j + CO_TILE : j1);
+}
+
+/*
+ * pool_thread - Helper thread, runs its band of every job it is part of
+ */
+static void *pool_thread(void *vargp)
+{
+	int id = (int)(long)vargp;
+	int seen = 0;
+
+	pthread_mutex_lock(&pool.lock);
+	while (1) {
+		while (pool.generation == seen)
+			pthread_cond_wait(&pool.start, &pool.lock);
+		seen = pool.generation;
+		if (id >= pool.nthreads)
+			continue;
+
+		pthread_mutex_unlock(&pool.lock);
+		run_band(id);
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.pending == 0)
+			pthread_cond_signal(&pool.done);
+	}
+	return NULL;
+}
+
+/*
+ * pool_run - Run a job on nthreads threads, the caller being thread 0.
+ *     Helpers are created the first time they are needed and kept.
+ */
+static void pool_run(int kind, int M, int N, int *A, int *B, int nthreads)
+{
+	pthread_t tid;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > PAR_MAX_THREADS)
+		nthreads = PAR_MAX_THREADS;
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.started < nthreads - 1) {
+		if (pthread_create(&tid, NULL, pool_thread,
+					(void *)(long)(pool.started + 1)) != 0) {
+			nthreads = pool.started + 1;
+			break;
+		}
+		pthread_detach(tid);
+		pool.started++;
+	}
+	pool.kind = kind;
+	pool.M = M;
+	pool.N = N;
+	pool.A = A;
+	pool.B = B;
+	pool.nthreads = nthreads;
+	pool.pending = nthreads - 1;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.lock);
+
+	run_band(0);
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.pending > 0)
+		pthread_cond_wait(&pool.done, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/*
+ * touch_parallel - Zero B with the partition trans_parallel_n uses for
+ *     the same thread count. Call it on fresh memory, so that each page
+ *     of B is placed on the node of the thread which will write it.
+ */
+void touch_parallel(int M, int N, int B[M][N], int nthreads)
+{
+	pool_run(PAR_TOUCH, M, N, NULL, &B[0][0], nthreads);
+}
+
+/*
+ * trans_parallel_n - Tiled transpose on nthreads threads
+ */
+void trans_parallel_n(int M, int N, int A[N][M], int B[M][N], int nthreads)
+{
+	pool_run(PAR_TRANS, M, N, &A[0][0], &B[0][0], nthreads);
+}
+
+/*
+ * trans_parallel - Tiled transpose on one thread per online CPU. Small
+ *     matrices are not worth waking the pool. Both traced builds, the
+ *     in-process one (TRACE_TRANS) and the one valgrind runs through
+ *     tracegen (TRACE_VALGRIND), stay on one thread: the cache model
+ *     is a single cache, and several threads would interleave their
+ *     accesses in its trace. Its miss count is then that of all the
+ *     bands run in turn on that one cache.
+ */
+char trans_parallel_desc[] = "Multi-threaded tiled transpose";
+void trans_parallel(int M, int N, int A[N][M], int B[M][N])
+{
+	int nthreads = 1;
+
+#if !defined(TRACE_TRANS) && !defined(TRACE_VALGRIND)
+	if (M * N >= PAR_MIN_ELEMS)
+		nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	trans_parallel_n(M, N, A, B, nthreads);
+}
+
+#ifdef __x86_64__
+/*
+ * tile_sse2 - Transpose the 4x4 tile at A[i][j] into B[j][i] in SSE2
+ *     registers: interleave pairs of rows by 32 bits, then by 64 bits.
+ */
+void tile_sse2(int M, int N, int A[N][M], int B[M][N], int i, int j)
+{
+	__m128i r0, r1, r2, r3, t0, t1, t2, t3;
+
+	r0 = _mm_loadu_si128(LOAD_PTR((__m128i *)&A[i][j]));
+	r1 = _mm_loadu_si128(LOAD_PTR((__m128i *)&A[i+1][j]));
+	r2 = _mm_loadu_si128(LOAD_PTR((__m128i *)&A[i+2][j]));
+	r3 = _mm_loadu_si128(LOAD_PTR((__m128i *)&A[i+3][j]));
+
+	t0 = _mm_unpacklo_epi32(r0, r1);	/* a0 b0 a1 b1 */
+	t1 = _mm_unpacklo_epi32(r2, r3);	/* c0 d0 c1 d1 */
+	t2 = _mm_unpackhi_epi32(r0, r1);	/* a2 b2 a3 b3 */
+	t3 = _mm_unpackhi_epi32(r2, r3);	/* c2 d2 c3 d3 */
+
+	_mm_storeu_si128(STORE_PTR((__m128i *)&B[j][i]), _mm_unpacklo_epi64(t0, t1));
+	_mm_storeu_si128(STORE_PTR((__m128i *)&B[j+1][i]), _mm_unpackhi_epi64(t0, t1));
+	_mm_storeu_si128(STORE_PTR((__m128i *)&B[j+2][i]), _mm_unpacklo_epi64(t2, t3));
+	_mm_storeu_si128(STORE_PTR((__m128i *)&B[j+3][i]), _mm_unpackhi_epi64(t2, t3));
+}
+
+/*
+ * tile_avx2 - Transpose the 8x8 tile at A[i][j] into B[j][i] in AVX2
+ *     registers: interleave by 32 and 64 bits inside each 128-bit
+ *     lane, then exchange the lanes.
+ */
+__attribute__((target("avx2")))
+void tile_avx2(int M, int N, int A[N][M], int B[M][N], int i, int j)
+{
+	__m256i r0, r1, r2, r3, r4, r5, r6, r7;
+	__m256i t0, t1, t2, t3, t4, t5, t6, t7;
+
+	r0 = _mm256_loadu_si256(LOAD_PTR((__m256i *)&A[i][j]));
+	r1 = _mm256_loadu_si256(LOAD_PTR((__m256i *)&A[i+1][j]));
+	r2 = _mm256_loadu_si256(LOAD_PTR((__m256i *)&A[i+2][j]));
+	r3 = _mm256_loadu_si256(LOAD_PTR((__m256i *)&A[i+3][j]));
+	r4 = _mm256_loadu_si256(LOAD_PTR((__m256i *)&A[i+4][j]));
+	r5 = _mm256_loadu_si256(LOAD_PTR((__m256i *)&A[i+5][j]));
+	r6 = _mm256_loadu_si256(LOAD_PTR((__m256i *)&A[i+6][j]));
+	r7 = _mm256_loadu_si256(LOAD_PTR((__m256i *)&A[i+7][j]));
+
+	/* a0 b0 a1 b1 | a4 b4 a5 b5 and so on */
+	t0 = _mm256_unpacklo_epi32(r0, r1);
+	t1 = _mm256_unpackhi_epi32(r0, r1);
+	t2 = _mm256_unpacklo_epi32(r2, r3);
+	t3 = _mm256_unpackhi_epi32(r2, r3);
+	t4 = _mm256_unpacklo_epi32(r4, r5);
+	t5 = _mm256_unpackhi_epi32(r4, r5);
+	t6 = _mm256_unpacklo_epi32(r6, r7);
+	t7 = _mm256_unpackhi_epi32(r6, r7);
+
+	/* a0 b0 c0 d0 | a4 b4 c4 d4 and so on */
+	r0 = _mm256_unpacklo_epi64(t0, t2);
+	r1 = _mm256_unpackhi_epi64(t0, t2);
+	r2 = _mm256_unpacklo_epi64(t1, t3);
+	r3 = _mm256_unpackhi_epi64(t1, t3);
+	r4 = _mm256_unpacklo_epi64(t4, t6);
+	r5 = _mm256_unpackhi_epi64(t4, t6);
+	r6 = _mm256_unpacklo_epi64(t5, t7);
+	r7 = _mm256_unpackhi_epi64(t5, t7);
+
+	/* Join the low lanes for columns 0-3, the high lanes for 4-7 */
+	_mm256_storeu_si256(STORE_PTR((__m256i *)&B[j][i]), _mm256_permute2x128_si256(r0, r4, 0x20));
+	_mm256_storeu_si256(STORE_PTR((__m256i *)&B[j+1][i]), _mm256_permute2x128_si256(r1, r5, 0x20));
+	_mm256_storeu_si256(STORE_PTR((__m256i *)&B[j+2][i]), _mm256_permute2x128_si256(r2, r6, 0x20));
+	_mm256_storeu_si256(STORE_PTR((__m256i *)&B[j+3][i]), _mm256_permute2x128_si256(r3, r7, 0x20));
+	_mm256_storeu_si256(STORE_PTR((__m256i *)&B[j+4][i]), _mm256_permute2x128_si256(r0, r4, 0x31));
+	_mm256_storeu_si256(STORE_PTR((__m256i *)&B[j+5][i]), _mm256_permute2x128_si256(r1, r5, 0x31));
+	_mm256_storeu_si256(STORE_PTR((__m256i *)&B[j+6][i]), _mm256_permute2x128_si256(r2, r6, 0x31));
+	_mm256_storeu_si256(STORE_PTR((__m256i *)&B[j+7][i]), _mm256_permute2x128_si256(r3, r7, 0x31));
+}
+
+/*
+ * trans_tiled - Blocked transpose whose full T x T tiles go through
+ *     the given micro-kernel. The rows and columns left over at the
+ *     edges are moved one element at a time.
+ */
+void trans_tiled(int M, int N, int A[N][M], int B[M][N], int T,
+		void (*tile)(int M, int N, int A[N][M], int B[M][N], int i, int j))
+{
+	int i, j;
+	int rows = N - N % T, cols = M - M % T;
+
+	for (i = 0; i < rows; i += T)
+		for (j = 0; j < cols; j += T)
+			tile(M, N, A, B, i, j);
+
+	for (i = 0; i < rows; i++)
+		for (j = cols; j < M; j++)
+			STORE(B[j][i], LOAD(A[i][j]));
+	for (i = rows; i < N; i++)
+		for (j = 0; j < M; j++)
+			STORE(B[j][i], LOAD(A[i][j]));
+}
+
+/*
+ * trans_sse2 - Blocked transpose with the 4x4 SSE2 micro-kernel.
+ */
+char trans_sse2_desc[] = "SSE2 4x4 register-shuffle transpose";
+void trans_sse2(int M, int N, int A[N][M], int B[M][N])
+{
+	trans_tiled(M, N, A, B, 4, tile_sse2);
+}
+
+/*
+ * trans_avx2 - Blocked transpose with the 8x8 AVX2 micro-kernel. Only
+ *     call it on a CPU which supports AVX2.
+ */
+void trans_avx2(int M, int N, int A[N][M], int B[M][N])
+{
+	trans_tiled(M, N, A, B, 8, tile_avx2);
+}
+
+/*
+ * trans_simd - Pick the widest micro-kernel the CPU supports, by
+ *     CPUID, the first time it is called.
+ */
+char trans_simd_desc[] = "SIMD transpose (AVX2 8x8 or SSE2 4x4 by CPUID)";
+void trans_simd(int M, int N, int A[N][M], int B[M][N])
+{
+	static void (*kernel)(int M, int N, int A[N][M], int B[M][N]) = NULL;
+
+	if (kernel == NULL) {
+		__builtin_cpu_init();
+		kernel = __builtin_cpu_supports("avx2") ? trans_avx2 : trans_sse2;
+	}
+	kernel(M, N, A, B);
+}
+#endif
+
 /*
  * registerFunctions - This function registers your transpose
  *     functions with the driver.  At runtime, the driver will
@@ -223,6 +963,19 @@ void registerFunctions()
     /* Register any additional transpose functions */
     registerTransFunction(trans, trans_desc); 
 
+    registerTransFunction(trans_oblivious, trans_oblivious_desc);
+    registerTransFunction(trans_inplace, trans_inplace_desc);
+
+    /* Use the configurations saved by autotune, if any */
+    loadTuning(TUNE_FILE);
+    registerTransFunction(trans_tuned, trans_tuned_desc);
+    registerTransFunction(trans_parallel, trans_parallel_desc);
+
+#ifdef __x86_64__
+    registerTransFunction(trans_sse2, trans_sse2_desc);
+    registerTransFunction(trans_simd, trans_simd_desc);
+#endif
+
 }
 
 /* 